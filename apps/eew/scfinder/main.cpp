@@ -49,9 +49,18 @@
 
 
 #include <seiscomp/io/archive/xmlarchive.h>
+#include <seiscomp/io/recordinput.h>
+#include <seiscomp/io/recordstream.h>
 #include <seiscomp/processing/eewamps/processor.h>
 #include <seiscomp/math/geo.h>
 #include <functional>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <ctime>
 #include <seiscomp/geo/featureset.h>
 
 #include "finder.h"
@@ -105,89 +114,262 @@ bool epochMatch(const T *obj, const Core::Time &ref) {
 }
 
 
+int64_t microseconds(const Core::Time &t) {
+	return (int64_t)t.seconds() * 1000000 + t.microseconds();
+}
+
+
+int64_t microseconds(const Core::TimeSpan &ts) {
+	return (int64_t)ts.seconds() * 1000000 + ts.microseconds();
+}
+
+
 /**
- * @brief The Ring class implements a simple ring buffer of any type which has
- *        an attribute timestamp. Elements are organized ordered by timestamp
- *        and max(timestamp) - min(timestamp) will never exceed the configured
- *        capacity.
+ * @brief The Ring class implements a ring buffer of any type which has an
+ *        attribute timestamp. Values are stored in time slots of the
+ *        configured interval, slot = timestamp / interval, so inserting a
+ *        value that arrives out of order does not move any other value.
+ *        Slots which drop out of the buffer are reused in place. Because
+ *        whole slots are kept, max(timestamp) - min(timestamp) may exceed
+ *        the configured capacity by less than one interval. firstTime()
+ *        returns the boundary before which values are not buffered.
  */
 template <typename T>
-class Ring : public std::deque<T> {
+class Ring {
 	public:
-		Ring(const Core::TimeSpan &capacity = Core::TimeSpan(0,0))
-		: _capacity(capacity) {}
+		Ring() : _slotLength(1000000), _last(0), _empty(true) {}
 
 
 	public:
-		void setCapacity(const Core::TimeSpan &capacity) {
+		void setup(const Core::TimeSpan &capacity, const Core::TimeSpan &interval) {
 			_capacity = capacity;
+			_slotLength = microseconds(interval);
+			if ( _slotLength <= 0 ) _slotLength = 1000000;
 
-			if ( std::deque<T>::empty() ) return;
+			_slots.clear();
+			_slots.resize(microseconds(capacity) / _slotLength + 1);
+			_empty = true;
+		}
 
-			Core::Time tmin = std::deque<T>::back().timestamp - _capacity;
-			while ( !std::deque<T>::empty()
-			   &&   (std::deque<T>::front().timestamp < tmin) )
-				std::deque<T>::pop_front();
+
+		const Core::TimeSpan &capacity() const {
+			return _capacity;
+		}
+
+
+		bool empty() const {
+			return _empty;
+		}
+
+
+		//! Returns the start time of the oldest slot, all buffered values
+		//! are at or after this time
+		Core::Time firstTime() const {
+			int64_t us = firstSlot() * _slotLength;
+			return Core::Time((long)(us / 1000000), (long)(us % 1000000));
+		}
+
+
+		//! Returns the oldest value
+		const T &front() const {
+			for ( int64_t s = firstSlot(); s < _last; ++s ) {
+				const Slot &slot = _slots[position(s)];
+				if ( slot.index == s && !slot.values.empty() )
+					return slot.values.front();
+			}
+
+			return _slots[position(_last)].values.front();
+		}
+
+
+		//! Returns the latest value
+		const T &back() const {
+			return _slots[position(_last)].values.back();
 		}
 
 
 		bool feed(const T &v) {
-			typename std::deque<T>::iterator it;
+			int64_t s = microseconds(v.timestamp) / _slotLength;
+
+			if ( _empty ) {
+				_last = s;
+				_empty = false;
+			}
+			else if ( s > _last )
+				_last = s;
+			// Value out of buffers capacity
+			else if ( s < firstSlot() )
+				return false;
 
-			// Find correct insert position
+			Slot &slot = _slots[position(s)];
+			if ( slot.index != s ) {
+				// Reuse expired slot
+				slot.index = s;
+				slot.values.clear();
+			}
 
-			// When empty, put it at the end
-			if ( std::deque<T>::empty() )
-				it = std::deque<T>::end();
-			else {
-				// When the last value is before value, append value
-				const T &last = std::deque<T>::back();
-				if ( v.timestamp >= last.timestamp )
-					it = std::deque<T>::end();
-				else {
-					// When first value is after value, prepend value
-					if ( v.timestamp < std::deque<T>::front().timestamp ) {
-						// Value out of buffers capacity
-						if ( v.timestamp < last.timestamp - _capacity )
-							return false;
+			// Values with equal slots are ordered by timestamp, the insert
+			// position is in most cases the end
+			typename std::vector<T>::iterator it = slot.values.end();
+			while ( it != slot.values.begin() && v.timestamp < (it-1)->timestamp )
+				--it;
 
-						it = std::deque<T>::begin();
-					}
-					else {
-						// The most timeconsuming task is now to find a
-						// proper position to insert the value
-						// Precondition: v.timestamp < back.timestamp
-						//               v.timestamp >= front.timestamp
-						typename std::deque<T>::reverse_iterator current = std::deque<T>::rbegin();
-
-						bool found = false;
-						for ( ; current != std::deque<T>::rend(); ++current ) {
-							if ( v.timestamp >= (*current).timestamp ) {
-								it = (current).base();
-								found = true;
-								break;
-							}
-						}
+			slot.values.insert(it, v);
 
-						if ( !found )
-							throw std::runtime_error("no buffer location found");
-					}
-				}
+			return true;
+		}
+
+
+		//! Calls func for each value ordered by timestamp
+		template <typename Func>
+		void forEach(Func func) const {
+			if ( _empty ) return;
+
+			for ( int64_t s = firstSlot(); s <= _last; ++s ) {
+				const Slot &slot = _slots[position(s)];
+				if ( slot.index != s ) continue;
+				for ( size_t i = 0; i < slot.values.size(); ++i )
+					func(slot.values[i]);
 			}
+		}
+
+
+	private:
+		struct Slot {
+			Slot() : index(-1) {}
+
+			int64_t        index;
+			std::vector<T> values;
+		};
+
+
+		int64_t firstSlot() const {
+			return _last - (int64_t)_slots.size() + 1;
+		}
+
+		size_t position(int64_t s) const {
+			return (size_t)(s % (int64_t)_slots.size());
+		}
+
+
+	private:
+		Core::TimeSpan    _capacity;
+		int64_t           _slotLength;
+		std::vector<Slot> _slots;
+		int64_t           _last;
+		bool              _empty;
+};
+
+
+/**
+ * @brief The MaximumQueue class holds the candidates for the maximum of a
+ *        sliding time window over values of any type which has the attributes
+ *        timestamp and value. A value is only kept as long as no later value
+ *        is larger or equal, so timestamps increase and values decrease from
+ *        front to back. The maximum of all values at or after a given time is
+ *        the first candidate at or after that time and of equal values the
+ *        latest one is returned.
+ */
+template <typename T>
+class MaximumQueue : public std::deque<T> {
+	public:
+		typedef typename std::deque<T>::iterator iterator;
+		typedef typename std::deque<T>::const_iterator const_iterator;
+
+
+	public:
+		void feed(const T &v) {
+			// Insert position is behind all values with the same timestamp,
+			// in most cases the end
+			iterator it = std::deque<T>::end();
+			while ( it != std::deque<T>::begin() && v.timestamp < (it-1)->timestamp )
+				--it;
+
+			// Value is dominated by a later one
+			if ( it != std::deque<T>::end() && it->value >= v.value )
+				return;
 
+			// Remove all earlier values dominated by this value
+			iterator first = it;
+			while ( first != std::deque<T>::begin() && (first-1)->value <= v.value )
+				--first;
+
+			it = std::deque<T>::erase(first, it);
 			std::deque<T>::insert(it, v);
+		}
 
-			Core::Time tmin = std::deque<T>::back().timestamp - _capacity;
+
+		//! Removes all candidates before tmin
+		void expire(const Core::Time &tmin) {
 			while ( !std::deque<T>::empty()
 			   &&   (std::deque<T>::front().timestamp < tmin) )
 				std::deque<T>::pop_front();
+		}
 
-			return true;
+
+		//! Returns the maximum of all values at or after tmin or end() if
+		//! there is no such value
+		const_iterator find(const Core::Time &tmin) const {
+			return std::lower_bound(std::deque<T>::begin(), std::deque<T>::end(),
+			                        tmin, &MaximumQueue::before);
+		}
+
+
+	private:
+		static bool before(const T &v, const Core::Time &t) {
+			return v.timestamp < t;
+		}
+};
+
+
+/**
+ * @brief The ReplayProcessor class stands in for the envelope processor of
+ *        a stream if envelopes are replayed from a file. It does not process
+ *        any data but carries the stream attributes which are passed along
+ *        with each envelope value.
+ */
+class ReplayProcessor : public Processing::EEWAmps::BaseProcessor {
+	public:
+		ReplayProcessor(const Processing::EEWAmps::Config *config)
+		: Processing::EEWAmps::BaseProcessor(config, MeterPerSecondSquared) {}
+
+
+	protected:
+		void process(const Record *, const DoubleArray &) {}
+};
+
+
+/**
+ * @brief The NamePool class maps names to small integer IDs which stay
+ *        valid for the lifetime of the pool.
+ */
+class NamePool {
+	public:
+		typedef int ID;
+
+
+	public:
+		//! Returns the ID of name and adds it to the pool if required
+		ID id(const std::string &name) {
+			std::map<std::string, ID>::iterator it = _ids.find(name);
+			if ( it != _ids.end() )
+				return it->second;
+
+			ID id = (ID)_names.size();
+			_names.push_back(name);
+			_ids[name] = id;
+			return id;
+		}
+
+
+		const std::string &name(ID id) const {
+			return _names[id];
 		}
 
 
 	private:
-		Core::TimeSpan _capacity;
+		std::map<std::string, ID> _ids;
+		std::vector<std::string>  _names;
 };
 
 
@@ -232,9 +414,19 @@ class App : public Client::StreamApplication {
 			_finderClipTimeout.set(30);
 			// Default preferred data units
 			_preferredGainUnits = "M/S**2";
+			_preferredGainUnit = -1;
 
 			_finderAmplitudesDirty = false;
 			_finderScanDataDirty = false;
+			// Scan on envelope ticks is disabled by default, the default
+			// tick latency is 3s
+			_tickScheduling = false;
+			_tickLatency.set(3);
+			// Finder objects are processed sequentially by default
+			_finderThreads = 1;
+			_tickLength = 1000000;
+			_lastTick = _nextTick = 0;
+			_ticksStarted = false;
 			_regionFile = "" ;
 			_regionNames = "" ;
 		}
@@ -251,6 +443,7 @@ class App : public Client::StreamApplication {
 			commandline().addOption("Offline", "ts", "Start time of data acquisition time window, requires also --te", &_strTs, false);
 			commandline().addOption("Offline", "te", "End time of data acquisition time window, requires also --ts", &_strTe, false);
 			commandline().addOption("Offline", "calculate-mask", "Calculate FinDer mask according to FinDer and envelope configuration, output in specified path, and exit", &_strMask, false);
+			commandline().addOption("Offline", "replay-envelopes", "Replay acceleration envelopes from a miniSEED file written by sceewenv --dump-envelope acc with a virtual clock, report processing statistics and exit, this implies --offline and --playback", &_replayFile, false);
 
 			commandline().addGroup("Mode");
 			commandline().addOption("Mode", "playback", "Run in playback mode which means that the reference time is set to the timestamp to the latest record instead of systemtime (disables warning on delay)");
@@ -298,6 +491,12 @@ class App : public Client::StreamApplication {
 				_testMode = true;
 			}
 
+			if ( !_replayFile.empty() ) {
+				setMessagingEnabled(false);
+				_testMode = true;
+				_playbackMode = true;
+			}
+
 			return true;
 		}
 
@@ -367,6 +566,24 @@ class App : public Client::StreamApplication {
 			}
 			catch ( ... ) {}
 
+			try {
+				_tickScheduling = configGetBool("finder.tickScheduling");
+			}
+			catch ( ... ) {}
+
+			try {
+				_tickLatency = configGetDouble("finder.tickLatency");
+			}
+			catch ( ... ) {}
+
+			try {
+				_finderThreads = configGetInt("finder.threads");
+			}
+			catch ( ... ) {}
+
+			// Gain units are compared by their ID
+			_preferredGainUnit = _preferredGainUnits.empty() ? -1 : _gainUnits.id(_preferredGainUnits);
+
 			auto* env = Seiscomp::Environment::Instance();
 			try {
 				_regionFile = env->absolutePath(configGetString("finder.regionFile"));
@@ -381,17 +598,20 @@ class App : public Client::StreamApplication {
 					SEISCOMP_ERROR("Failed to open region file %s", _regionFile.c_str());  
 					return false;
 				}
-				bool hasValidPolygon = false;
+				_regions.clear();
 				size_t numFeatures = _geoFeatureSet.features().size();
 				for (size_t i = 0; i < numFeatures; ++i) {
 					Seiscomp::Geo::GeoFeature* feature = _geoFeatureSet.features()[i];
 					std::string pattern = "," + feature->name() + ",";
-					if (_regionNames.find(pattern) != std::string::npos) {
-						hasValidPolygon = true;
-						break;
+					if (_regionNames.find(pattern) == std::string::npos) {
+						SEISCOMP_DEBUG("Filter region %s not in bna file polygons %s",
+							feature->name().c_str(),
+							_regionNames.c_str());
+						continue;
 					}
+					_regions.push_back(Region(feature));
 				}
-				if (!hasValidPolygon) {
+				if (_regions.empty()) {
 					SEISCOMP_ERROR("No polygon in %s matches any name in regionNames: %s",
 								_regionFile.c_str(), _regionNames.c_str());
 					return false;
@@ -450,7 +670,8 @@ class App : public Client::StreamApplication {
 			if ( _startTime.valid() ) recordStream()->setStartTime(_startTime);
 			if ( _endTime.valid() ) recordStream()->setEndTime(_endTime);
 
-			_eewProc.subscribeToChannels(recordStream(), Core::Time::GMT());
+			if ( _replayFile.empty() )
+				_eewProc.subscribeToChannels(recordStream(), Core::Time::GMT());
 
 			// We do not need lookup objects by publicID
 			PublicObject::SetRegistrationEnabled(false);
@@ -460,6 +681,19 @@ class App : public Client::StreamApplication {
 			if ( !initFinder() )
 				return false;
 
+			if ( _tickScheduling ) {
+				_tickLength = microseconds(_eewProc.configuration().vsfndr.envelopeInterval);
+				if ( _tickLength <= 0 ) _tickLength = 1000000;
+
+				// In real-time ticks also become due by the wall clock
+				if ( !_playbackMode )
+					enableTimer(1);
+
+				SEISCOMP_INFO("Scan and process with Finder once per envelope tick with a maximum latency of %fs",
+				              (double)_tickLatency);
+				return true;
+			}
+
 			if ( _finderProcessCallInterval != Core::TimeSpan(0,0) )
 				enableTimer(1);
 
@@ -575,11 +809,145 @@ class App : public Client::StreamApplication {
 			}
 
 			_appStartTime = Core::Time::GMT();
+
+			if ( !_replayFile.empty() )
+				return replayEnvelopes();
+
 			return StreamApplication::run();
 		}
 
 
+		/**
+		 * Replays envelope values from a miniSEED file into the envelope
+		 * handler. The envelope timestamps drive the reference time and the
+		 * timer which makes the replay independent of the processing speed.
+		 * The CPU time is accounted per envelope tick of the reference time.
+		 */
+		bool replayEnvelopes() {
+			IO::RecordStreamPtr rs = IO::RecordStream::Create("file");
+			if ( !rs || !rs->setSource(_replayFile) ) {
+				SEISCOMP_ERROR("Failed to open envelope file %s", _replayFile.c_str());
+				return false;
+			}
+
+			typedef std::map<std::string, Processing::WaveformProcessorPtr> Processors;
+			Processors processors;
+
+			int64_t tickLength = microseconds(_eewProc.configuration().vsfndr.envelopeInterval);
+			if ( tickLength <= 0 ) tickLength = 1000000;
+
+			// The timer is only enabled with throttling and not for ticks
+			// in playback mode, see init()
+			bool timer = !_tickScheduling && _finderProcessCallInterval != Core::TimeSpan(0,0);
+			Core::Time nextTimeout;
+
+			int64_t tick = -1;
+			double tickCPU = 0;
+
+			IO::RecordInput input(rs.get(), Array::FLOAT, Record::DATA_ONLY);
+			for ( IO::RecordIterator it = input.begin(); it != input.end(); ++it ) {
+				RecordPtr rec = *it;
+				if ( isExitRequested() ) break;
+
+				const FloatArray *data = FloatArray::ConstCast(rec->data());
+				if ( data == NULL ) continue;
+
+				Processing::WaveformProcessorPtr &proc = processors[rec->streamID()];
+				if ( !proc ) {
+					ReplayProcessor *replay = new ReplayProcessor(&_eewProc.configuration());
+					string channel = rec->channelCode();
+
+					// Horizontal envelopes are dumped with an X appended to
+					// the band and instrument code
+					if ( channel.size() == 3 && channel[2] == 'X' ) {
+						replay->setUsedComponent(Processing::WaveformProcessor::FirstHorizontal);
+						channel.erase(2);
+					}
+					else
+						replay->setUsedComponent(Processing::WaveformProcessor::Vertical);
+
+					replay->setWaveformID(WaveformStreamID(rec->networkCode(), rec->stationCode(),
+					                                       rec->locationCode(), channel, ""));
+					proc = replay;
+				}
+
+				const Processing::EEWAmps::BaseProcessor *envProc =
+					static_cast<const Processing::EEWAmps::BaseProcessor*>(proc.get());
+
+				for ( int i = 0; i < data->size(); ++i ) {
+					Core::Time timestamp = rec->startTime();
+					if ( rec->samplingFrequency() > 0 )
+						timestamp += Core::TimeSpan(i / rec->samplingFrequency());
+
+					if ( !_replayStats.firstEnvelope.valid() )
+						_replayStats.firstEnvelope = timestamp;
+
+					std::clock_t start = std::clock();
+
+					handleEnvelope(envProc, (*data)[i], timestamp, false);
+
+					if ( timer && _referenceTime >= nextTimeout ) {
+						handleTimeout();
+						nextTimeout = _referenceTime + Core::TimeSpan(1,0);
+					}
+
+					double cpu = (double)(std::clock() - start) / CLOCKS_PER_SEC;
+
+					int64_t valueTick = microseconds(_referenceTime) / tickLength;
+					if ( valueTick != tick ) {
+						if ( tick >= 0 ) closeReplayTick(tickCPU);
+						tick = valueTick;
+						tickCPU = 0;
+					}
+
+					tickCPU += cpu;
+					++_replayStats.values;
+				}
+			}
+
+			// Scan the ticks which not all streams delivered at the end of
+			// the replay
+			std::clock_t start = std::clock();
+			flushTicks();
+			tickCPU += (double)(std::clock() - start) / CLOCKS_PER_SEC;
+
+			if ( tick >= 0 ) closeReplayTick(tickCPU);
+
+			cerr << "Replayed " << _replayStats.values << " envelope values of "
+			     << processors.size() << " streams" << endl;
+			if ( _replayStats.ticks > 0 )
+				cerr << "Ticks: " << _replayStats.ticks
+				     << ", CPU time per tick: mean "
+				     << 1000 * _replayStats.cpuTotal / _replayStats.ticks << " ms, max "
+				     << 1000 * _replayStats.cpuMax << " ms, total "
+				     << _replayStats.cpuTotal << " s" << endl;
+			cerr << "Scan_Data calls: " << _replayStats.scans << endl;
+			if ( _replayStats.firstAlert.valid() )
+				cerr << "First alert at " << _replayStats.firstAlert.iso() << ": "
+				     << (double)(_replayStats.firstAlert - _replayStats.firstEnvelope)
+				     << " s after the first envelope, "
+				     << (double)(_replayStats.firstAlert - _replayStats.firstAlertOrigin)
+				     << " s after origin time" << endl;
+			else
+				cerr << "No alert" << endl;
+
+			return true;
+		}
+
+
+		void closeReplayTick(double cpu) {
+			++_replayStats.ticks;
+			_replayStats.cpuTotal += cpu;
+			if ( cpu > _replayStats.cpuMax )
+				_replayStats.cpuMax = cpu;
+		}
+
+
 		void done() {
+			// Ticks of the end of a playback are not waited for anymore
+			if ( _playbackMode )
+				flushTicks();
+
 			Core::Time now = Core::Time::GMT();
 			int secs = (now-_appStartTime).seconds();
 			if ( !_testMode )
@@ -611,14 +979,134 @@ class App : public Client::StreamApplication {
 				return;
 			}
 
-			string id = proc->waveformID().networkCode() + "." +
-			            proc->waveformID().stationCode() + "." +
-			            proc->waveformID().locationCode();
-
 			if ( clipped ) {
 				SEISCOMP_WARNING("[%s] Envelope clipped",proc->streamID().c_str());
 			}
 
+			// The stream of a processor is only resolved again if the
+			// location epoch does not match
+			StreamLookup::iterator sit = _streams.find(proc);
+			StreamInfo *stream = sit != _streams.end() ? &sit->second : NULL;
+			if ( stream == NULL || !epochMatch(stream->buddy->meta, timestamp) ) {
+				stream = resolveStream(proc, timestamp);
+				if ( stream == NULL ) return;
+			}
+
+			Buddy *buddy = stream->buddy;
+
+			// The reference time is the global ticker of the current time. That
+			// should work for real-time as well as playbacks. It always points
+			// to the latest timestamp of any envelope value.
+			bool referenceTimeUpdated = false;
+
+			// If in playback mode then use the latest envelope timestamp as
+			// reference time.
+			Core::Time tick = _playbackMode ? timestamp : Core::Time::GMT();
+
+			if ( _referenceTime < tick ) {
+				_referenceTime = tick;
+				referenceTimeUpdated = true;
+			}
+
+			// The minimum time for a valid amplitude
+			//Core::Time minAmplTime = _referenceTime - _bufferLength;
+			Core::Time minAmplTime = _referenceTime - _bufVarLen;
+
+			#if defined(LOG_AMPS)
+			std::cout << "+ " << proc->streamID() << "   " << _referenceTime.iso() << "   " << minAmplTime.iso() << "   " << timestamp.iso() << "   " << value << "   clipped:" << clipped << std::endl;
+
+			#endif
+			// Buffer envelope value
+			Amplitude ampl(value, timestamp, stream->channel, clipped, stream->gainUnit);
+			if ( buddy->feed(ampl, _preferredGainUnit) ) {
+				// Buffer changed -> update maximum
+				if ( (buddy->maxPGA.timestamp < minAmplTime)
+				  || (timestamp < minAmplTime)
+				  || (value >= buddy->maxPGA.value) ) {
+					if ( updateMaximum(buddy, minAmplTime) ) {
+						#if defined(LOG_AMPS)
+						std::cout << "M " << buddy->id << "   " << buddy->maxPGA.timestamp.iso() << "   " << buddy->maxPGA.value << "   clipped: " << buddy->maxPGA.clipped << std::endl;
+						#endif
+					}
+				}
+			}
+
+			// If reference time has updated then all locations whose maximum
+			// left the time window must be updated as well
+			if ( referenceTimeUpdated ) {
+				if ( minAmplTime < _minAmplTime ) {
+					LocationLookup::iterator it;
+					// The time window has grown, check all locations
+					for ( it = _locationLookup.begin(); it != _locationLookup.end(); ++it ) {
+						if ( it->second->maxPGA.timestamp >= minAmplTime ) continue;
+						if ( updateMaximum(it->second.get(), minAmplTime) ) {
+							#if defined(LOG_AMPS)
+							std::cout << "M " << it->first << "   " << it->second->maxPGA.timestamp.iso() << "   " << it->second->maxPGA.value << "   clipped: " << it->second->maxPGA.clipped << std::endl;
+							#endif
+						}
+					}
+				}
+				else {
+					std::vector<Buddy*> expired;
+					while ( !_maximumIndex.empty()
+					     && _maximumIndex.begin()->first < minAmplTime ) {
+						expired.push_back(_maximumIndex.begin()->second);
+						expired.back()->indexed = false;
+						_maximumIndex.erase(_maximumIndex.begin());
+					}
+
+					for ( size_t i = 0; i < expired.size(); ++i ) {
+						if ( updateMaximum(expired[i], minAmplTime) ) {
+							#if defined(LOG_AMPS)
+							std::cout << "M " << expired[i]->id << "   " << expired[i]->maxPGA.timestamp.iso() << "   " << expired[i]->maxPGA.value << "   clipped: " << expired[i]->maxPGA.clipped << std::endl;
+							#endif
+						}
+					}
+				}
+
+				_minAmplTime = minAmplTime;
+			}
+
+			_finderAmplitudesDirty = true;
+
+			if ( _tickScheduling ) {
+				updateTick(*stream, timestamp);
+				scanDueTicks();
+				return;
+			}
+
+			// Maximum updated, call Finder
+			scanFinderData();
+		}
+
+
+		void handleTimeout() {
+			if ( _tickScheduling ) {
+				scanDueTicks();
+				return;
+			}
+
+			// Scan data
+			scanFinderData();
+
+			// Call Finder
+			processFinder();
+		}
+
+
+		/**
+		 * Resolves the location of a processor's stream and stores it in the
+		 * stream entry of the processor. Channel code and gain unit IDs
+		 * are resolved once per stream, the gain unit is taken from the
+		 * vertical component of the stream's sensor.
+		 * @return The stream entry or NULL if the location is not available
+		 */
+		StreamInfo *resolveStream(const Processing::EEWAmps::BaseProcessor *proc,
+		                          const Core::Time &timestamp) {
+			string id = proc->waveformID().networkCode() + "." +
+			            proc->waveformID().stationCode() + "." +
+			            proc->waveformID().locationCode();
+
 			LocationLookup::iterator it;
 			it = _locationLookup.find(id);
 			if ( it == _locationLookup.end() || !epochMatch(it->second->meta, timestamp) ) {
@@ -636,7 +1124,7 @@ class App : public Client::StreamApplication {
 					                 proc->waveformID().stationCode().c_str(),
 					                 proc->waveformID().locationCode().c_str(),
 					                 timestamp.iso().c_str());
-					return;
+					return NULL;
 				}
 
 				try {
@@ -649,35 +1137,40 @@ class App : public Client::StreamApplication {
 					                 proc->waveformID().stationCode().c_str(),
 					                 proc->waveformID().locationCode().c_str(),
 					                 e.what());
-					return;
+					return NULL;
 				}								
 				if ( it == _locationLookup.end() ) {
 					BuddyPtr buddy = new Buddy;
-					buddy->pgas.setCapacity(_bufferLength),
+					buddy->id = id;
+					buddy->pgas.setup(_bufferLength, _eewProc.configuration().vsfndr.envelopeInterval);
 					buddy->meta = loc;
 					_locationLookup[id] = buddy;
 					it = _locationLookup.find(id); 
 				}
-				else
+				else {
 					it->second->meta = loc;
+					it->second->pgaDirty = true;
+				}
 			}
 
-			// Retrieving the gain unit for a specific channel 
-			string gainunit = "none" ; 
-			string channel = proc->waveformID().channelCode().substr(0,2); 
+			StreamInfo &info = _streams[proc];
+			info.buddy = it->second.get();
+
+			if ( info.channel < 0 ) {
+				info.channel = _channelCodes.id(proc->waveformID().channelCode());
+
+				// Retrieving the gain unit for a specific channel 
+				string gainunit = "none";
+				string channel = proc->waveformID().channelCode().substr(0,2);
 
-			if (it->second->gainunits.find(channel) != it->second->gainunits.end()) {
-				gainunit = it->second->gainunits[channel] ; 
-			} else {
 				DataModel::Stream *stream = Client::Inventory::Instance()->getStream(proc->waveformID().networkCode(), 
 						proc->waveformID().stationCode(),
 						proc->waveformID().locationCode(),
 						channel+"Z", 
 						timestamp);
-				if ( stream ) {
-					gainunit = stream->gainUnit().c_str() ; 
-					it->second->gainunits[channel] = gainunit ; //.insert(make_pair(channel, gainunit));
-				} else {
+				if ( stream )
+					gainunit = stream->gainUnit();
+				else {
 					SEISCOMP_WARNING(
 							"[%s.%s.%s.%s] unable to retrieve gain unit from inventory", 
 										proc->waveformID().networkCode().c_str(),
@@ -685,70 +1178,81 @@ class App : public Client::StreamApplication {
 										proc->waveformID().locationCode().c_str(), 
 										proc->waveformID().channelCode().c_str());
 				}
+
+				info.gainUnit = _gainUnits.id(gainunit);
 			}
 
-			// The reference time is the global ticker of the current time. That
-			// should work for real-time as well as playbacks. It always points
-			// to the latest timestamp of any envelope value.
-			bool referenceTimeUpdated = false;
+			return &info;
+		}
 
-			// If in playback mode then use the latest envelope timestamp as
-			// reference time.
-			Core::Time tick = _playbackMode ? timestamp : Core::Time::GMT();
 
-			if ( _referenceTime < tick ) {
-				_referenceTime = tick;
-				referenceTimeUpdated = true;
+		/**
+		 * Records the latest envelope tick of a stream. A tick is the index
+		 * of the envelope interval, timestamp / interval.
+		 */
+		void updateTick(StreamInfo &stream, const Core::Time &timestamp) {
+			int64_t tick = microseconds(timestamp) / _tickLength;
+
+			if ( !_ticksStarted ) {
+				_nextTick = _lastTick = tick;
+				_ticksStarted = true;
+			}
+			else if ( tick > _lastTick )
+				_lastTick = tick;
+
+			if ( stream.tick < 0 )
+				stream.tick = tick;
+			else if ( tick > stream.tick ) {
+				TickCounts::iterator cit = _streamsPerTick.find(stream.tick);
+				if ( --cit->second == 0 )
+					_streamsPerTick.erase(cit);
+				stream.tick = tick;
 			}
+			else
+				return;
 
-			// The minimum time for a valid amplitude
-			//Core::Time minAmplTime = _referenceTime - _bufferLength;
-			Core::Time minAmplTime = _referenceTime - _bufVarLen;
+			++_streamsPerTick[tick];
+		}
 
-			#if defined(LOG_AMPS)
-			std::cout << "+ " << id << "." << proc->waveformID().channelCode() << "   " << _referenceTime.iso() << "   " << minAmplTime.iso() << "   " << timestamp.iso() << "   " << value << "   clipped:" << clipped << std::endl;
 
-			#endif
-			// Buffer envelope value
-			if ( it->second->pgas.feed(Amplitude(value, timestamp, proc->waveformID().channelCode(), clipped, gainunit)) ) {
-				// Buffer changed -> update maximum
-				if ( (it->second->maxPGA.timestamp < minAmplTime)
-				  || (timestamp < minAmplTime)
-				  || (value >= it->second->maxPGA.value) ) {
-					if ( it->second->updateMaximum(minAmplTime, _preferredGainUnits) ) {
-						#if defined(LOG_AMPS)
-						std::cout << "M " << id << "   " << it->second->maxPGA.timestamp.iso() << "   " << it->second->maxPGA.value << "   clipped: " << it->second->maxPGA.clipped << std::endl;
-						#endif
-					}
-				}
-			}
+		/**
+		 * Scans the data once if ticks became due since the last scan. A tick
+		 * is due if all streams have delivered it. Streams whose latest tick
+		 * lags behind the clock by more than the tick latency are not waited
+		 * for. The clock is the latest tick in playback mode and the system
+		 * time otherwise so that playbacks do not depend on the processing
+		 * speed.
+		 */
+		void scanDueTicks() {
+			if ( !_ticksStarted ) return;
 
-			// If reference time has updated then all locations must be updated
-			// as well
-			if ( referenceTimeUpdated ) {
-				for ( it = _locationLookup.begin(); it != _locationLookup.end(); ++it ) {
-					if ( it->second->maxPGA.timestamp >= minAmplTime ) continue;
-					if ( it->second->updateMaximum(minAmplTime, _preferredGainUnits) ) {
-						#if defined(LOG_AMPS)
-						std::cout << "M " << it->first << "   " << it->second->maxPGA.timestamp.iso() << "   " << it->second->maxPGA.value << "   clipped: " << it->second->maxPGA.clipped << std::endl;
-						#endif
-					}
-				}
-			}
+			int64_t clock = _playbackMode ? _lastTick : microseconds(Core::Time::GMT()) / _tickLength;
+			int64_t minTick = clock - microseconds(_tickLatency) / _tickLength;
 
-			_finderAmplitudesDirty = true;
+			// The earliest latest tick of all streams that are waited for
+			int64_t dueTick = _lastTick;
+			TickCounts::iterator it = _streamsPerTick.lower_bound(minTick);
+			if ( it != _streamsPerTick.end() && it->first < dueTick )
+				dueTick = it->first;
 
-			// Maximum updated, call Finder
+			if ( dueTick < _nextTick ) return;
+
+			// All due ticks see the same data, scan only once
+			_nextTick = dueTick + 1;
 			scanFinderData();
 		}
 
 
-		void handleTimeout() {
-			// Scan data
-			scanFinderData();
+		/**
+		 * Scans the data once for all remaining ticks up to the latest tick
+		 * without waiting for any stream, e.g. at the end of a playback.
+		 */
+		void flushTicks() {
+			if ( !_tickScheduling || !_ticksStarted || _nextTick > _lastTick )
+				return;
 
-			// Call Finder
-			processFinder();
+			_nextTick = _lastTick + 1;
+			scanFinderData();
 		}
 
 
@@ -757,9 +1261,9 @@ class App : public Client::StreamApplication {
 			//if ( !_finderAmplitudesDirty )
 			//	return;
 
-			if ( _finderScanCallInterval != Core::TimeSpan(0,0) ) {
+			if ( !_tickScheduling && _finderScanCallInterval != Core::TimeSpan(0,0) ) {
 				// Throttle call frequency
-				Core::Time now = Core::Time::GMT();
+				Core::Time now = throttleClock();
 				if ( now - _lastFinderScanCall < _finderScanCallInterval )
 					return;
 
@@ -771,7 +1275,8 @@ class App : public Client::StreamApplication {
 
 			LocationLookup::iterator it;
 
-			_latestMaxPGAs.clear();
+			// Locations which became eligible or ineligible
+			bool eligibilityChanged = false;
 
 			#if defined(LOG_AMPS)
 			std::cout << ">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>" << std::endl;
@@ -780,51 +1285,56 @@ class App : public Client::StreamApplication {
 			std::cout << _referenceTime.iso() << std::endl;
 			#endif
 			for ( it = _locationLookup.begin(); it != _locationLookup.end(); ++it ) {
-				if ( !it->second->maxPGA.timestamp.valid() ) continue;
-				
-				string mseedid = it->second->meta->station()->network()->code() + "." +
-					it->second->meta->station()->code() + "." +
-			        it->second->meta->code() + "." + 
-					it->second->maxPGA.channel;
-
-				/* checks whether the timestamp of the last element in the pgas vector 
-				falls within the previous 15 seconds, continuing the loop if true */
-				if ( ( it->second->pgas.back().timestamp.seconds() ) < ( _referenceTime.seconds() - _finderMaxEnvelopeBufferDelay ) ) {
-					std::cout << "Instrument skipped \t PGA buffer starts (iso,s)\t PGA buffer end (iso,s)\t Reference time (iso,s)" << std::endl;
-					std::cout << it->first << "\t" << it->second->pgas.front().timestamp.iso() << "\t" << it->second->pgas.back().timestamp.iso() << "\t" << _referenceTime.iso() << std::endl;
-					std::cout << it->first << "\t" << it->second->pgas.front().timestamp.seconds() << "\t" << it->second->pgas.back().timestamp.seconds() <<  "\t" << _referenceTime.seconds() << std::endl;
-					continue;
-				}
+				Buddy *buddy = it->second.get();
+				bool eligible = isEligible(it->first, buddy);
 
-				/* Checking conditions related to clipping of an instrument's data */
-				if ( it->second->pgas.back().clipped ) {
-					SEISCOMP_DEBUG("[%s] Instrument clipped and skipped", mseedid.c_str());
-					continue;
+				if ( eligible != (buddy->pgaIndex >= 0) ) {
+					buddy->pgaIndex = eligible ? 0 : -1;
+					eligibilityChanged = true;
+				}
+				else if ( eligible && buddy->pgaDirty ) {
+					// Update the PGA of the location in place
+					_latestMaxPGAs[buddy->pgaIndex] = pgaData(buddy);
+					buddy->pgaDirty = false;
 				}
-				if ( ( it->second->maxPGA.lastclipped.seconds() ) >= ( _referenceTime.seconds() - _finderClipTimeout ) ) {
-					SEISCOMP_DEBUG("[%s] Instrument clipped recently and skipped", mseedid.c_str());
-					continue;
-				}	
-
-				_latestMaxPGAs.push_back(
-					PGA_Data(
-						it->second->meta->station()->code(),
-						it->second->meta->station()->network()->code(),
-						it->second->maxPGA.channel.c_str(),
-						it->second->meta->code().empty()?"--":it->second->meta->code().c_str(),
-						Coordinate(it->second->meta->latitude(), it->second->meta->longitude()),
-						it->second->maxPGA.value*100, 
-						it->second->maxPGA.timestamp
-					)
-				);
+
+				if ( !eligible ) continue;
 
 				#if defined(LOG_AMPS)
-				std::cout << it->first << "   " << it->second->maxPGA.timestamp.iso() << "   " << it->second->maxPGA.timestamp.seconds() << "   " << (it->second->maxPGA.value*100) << std::endl;
+				std::cout << it->first << "   " << buddy->maxPGA.timestamp.iso() << "   " << buddy->maxPGA.timestamp.seconds() << "   " << (buddy->maxPGA.value*100) << std::endl;
 				#endif
 				#ifdef LOG_FINDER_PGA
-				std::cout << "\t" << std::setw(12) << it->first << "\t" << it->second->maxPGA.timestamp.iso() << "\t" << (it->second->maxPGA.value*100) << std::endl;
+				std::cout << "\t" << std::setw(12) << it->first << "\t" << buddy->maxPGA.timestamp.iso() << "\t" << (buddy->maxPGA.value*100) << std::endl;
 				#endif
 			}
+
+			// The PGA list is ordered by location id, so it is only rebuilt
+			// if the set of eligible locations changed. Unchanged PGAs are
+			// taken from the current list.
+			if ( eligibilityChanged ) {
+				PGA_Data_List pgas;
+				pgas.reserve(_locationLookup.size());
+
+				for ( it = _locationLookup.begin(); it != _locationLookup.end(); ++it ) {
+					Buddy *buddy = it->second.get();
+					if ( buddy->pgaIndex < 0 ) {
+						buddy->pgaListed = false;
+						continue;
+					}
+
+					if ( buddy->pgaListed && !buddy->pgaDirty )
+						pgas.push_back(_latestMaxPGAs[buddy->pgaIndex]);
+					else
+						pgas.push_back(pgaData(buddy));
+
+					buddy->pgaIndex = (int)pgas.size()-1;
+					buddy->pgaListed = true;
+					buddy->pgaDirty = false;
+				}
+
+				_latestMaxPGAs.swap(pgas);
+			}
+
 			#if defined(LOG_AMPS)
 			std::cout << "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<" << std::endl;
 			#endif
@@ -833,6 +1343,8 @@ class App : public Client::StreamApplication {
 			Coordinate_List clist;
 			Coordinate_List::iterator cit;
 
+			++_replayStats.scans;
+
 			try {
 				clist = Finder::Scan_Data(_latestMaxPGAs, _finderList);
 			}
@@ -861,13 +1373,66 @@ class App : public Client::StreamApplication {
 		}
 
 
+		/**
+		 * Returns whether the maximum PGA of a location is passed to FinDer:
+		 * the location must have received data within the maximum envelope
+		 * buffer delay and must not be clipped.
+		 */
+		bool isEligible(const std::string &id, const Buddy *buddy) const {
+			if ( !buddy->maxPGA.timestamp.valid() ) return false;
+
+			/* checks whether the timestamp of the last element in the pgas vector 
+			falls within the previous 15 seconds, continuing the loop if true */
+			if ( ( buddy->pgas.back().timestamp.seconds() ) < ( _referenceTime.seconds() - _finderMaxEnvelopeBufferDelay ) ) {
+				std::cout << "Instrument skipped \t PGA buffer starts (iso,s)\t PGA buffer end (iso,s)\t Reference time (iso,s)" << std::endl;
+				std::cout << id << "\t" << buddy->pgas.front().timestamp.iso() << "\t" << buddy->pgas.back().timestamp.iso() << "\t" << _referenceTime.iso() << std::endl;
+				std::cout << id << "\t" << buddy->pgas.front().timestamp.seconds() << "\t" << buddy->pgas.back().timestamp.seconds() <<  "\t" << _referenceTime.seconds() << std::endl;
+				return false;
+			}
+
+			/* Checking conditions related to clipping of an instrument's data */
+			if ( buddy->pgas.back().clipped ) {
+				SEISCOMP_DEBUG("[%s.%s] Instrument clipped and skipped", id.c_str(),
+				               _channelCodes.name(buddy->maxPGA.channel).c_str());
+				return false;
+			}
+			if ( ( buddy->maxPGA.lastclipped.seconds() ) >= ( _referenceTime.seconds() - _finderClipTimeout ) ) {
+				SEISCOMP_DEBUG("[%s.%s] Instrument clipped recently and skipped", id.c_str(),
+				               _channelCodes.name(buddy->maxPGA.channel).c_str());
+				return false;
+			}
+
+			return true;
+		}
+
+
+		//! Returns the clock of the call throttling which is the virtual
+		//! clock, the reference time, if envelopes are replayed
+		Core::Time throttleClock() const {
+			return _replayFile.empty() ? Core::Time::GMT() : _referenceTime;
+		}
+
+
+		PGA_Data pgaData(const Buddy *buddy) const {
+			return PGA_Data(
+				buddy->meta->station()->code(),
+				buddy->meta->station()->network()->code(),
+				_channelCodes.name(buddy->maxPGA.channel).c_str(),
+				buddy->meta->code().empty()?"--":buddy->meta->code().c_str(),
+				Coordinate(buddy->meta->latitude(), buddy->meta->longitude()),
+				buddy->maxPGA.value*100,
+				buddy->maxPGA.timestamp
+			);
+		}
+
+
 		void processFinder() {
 			if ( !_finderScanDataDirty )
 				return;
 
-			if ( _finderProcessCallInterval != Core::TimeSpan(0,0) ) {
+			if ( !_tickScheduling && _finderProcessCallInterval != Core::TimeSpan(0,0) ) {
 				// Throttle call frequency
-				Core::Time now = Core::Time::GMT();
+				Core::Time now = throttleClock();
 				if ( now - _lastFinderProcessCall < _finderProcessCallInterval )
 					return;
 
@@ -878,17 +1443,68 @@ class App : public Client::StreamApplication {
 			Core::Time tick = _playbackMode ? _referenceTime : Core::Time::GMT();
 
 			#ifdef USE_FINDER
+			// With more than one thread all Finder objects are processed
+			// concurrently first, the PGA list is shared read-only. Errors
+			// are collected and logged in the order of the Finder objects,
+			// other exceptions are rethrown as in sequential processing.
+			size_t threadCount = min((size_t)max(_finderThreads, 1), _finderList.size());
+			std::vector<std::string> errors;
+			if ( threadCount > 1 ) {
+				errors.resize(_finderList.size());
+				std::exception_ptr failure;
+				std::mutex failureMutex;
+				std::atomic<size_t> next(0);
+
+				auto work = [&]() {
+					size_t i;
+					while ( (i = next++) < _finderList.size() ) {
+						try {
+							_finderList[i]->process(tick, _latestMaxPGAs);
+						}
+						catch ( FiniteFault::Error &e ) {
+							errors[i] = e.what();
+						}
+						// Exceptions must not escape a worker thread
+						catch ( ... ) {
+							std::lock_guard<std::mutex> lock(failureMutex);
+							if ( !failure )
+								failure = std::current_exception();
+						}
+					}
+				};
+
+				std::vector<std::thread> threads;
+				for ( size_t i = 1; i < threadCount; ++i )
+					threads.push_back(std::thread(work));
+
+				work();
+
+				for ( size_t i = 0; i < threads.size(); ++i )
+					threads[i].join();
+
+				if ( failure )
+					std::rethrow_exception(failure);
+			}
+
 			Finder_List::iterator fit;
 			double maxRupLen = 0.;
-			for ( fit = _finderList.begin(); fit != _finderList.end(); /* incrementing below */) {
-				// some method for getting the timestamp associated with the data
-				// event_continue == false when we want to stop processing
-				try {
-					(*fit)->process(tick, _latestMaxPGAs);
+			size_t index = 0;
+			for ( fit = _finderList.begin(); fit != _finderList.end(); ++index /* fit is incremented below */) {
+				if ( !errors.empty() ) {
+					if ( !errors[index].empty() )
+						SEISCOMP_ERROR("Exception from FinDer::process: %s", errors[index].c_str());
 				}
-				catch ( FiniteFault::Error &e ) {
-					SEISCOMP_ERROR("Exception from FinDer::process: %s", e.what());
+				else {
+					// some method for getting the timestamp associated with the data
+					// event_continue == false when we want to stop processing
+					try {
+						(*fit)->process(tick, _latestMaxPGAs);
+					}
+					catch ( FiniteFault::Error &e ) {
+						SEISCOMP_ERROR("Exception from FinDer::process: %s", e.what());
+					}
 				}
+
 				if ((*fit)->get_rupture_length() > maxRupLen) {
 					maxRupLen = (*fit)->get_rupture_length();
 				}
@@ -936,17 +1552,12 @@ class App : public Client::StreamApplication {
 			
 			if (!_regionFile.empty() && !_regionNames.empty()) {
 				bool validLatLon = false;
-				size_t numFeatures = _geoFeatureSet.features().size();
-				for (size_t i = 0; i < numFeatures; ++i) {
-					Seiscomp::Geo::GeoFeature *feature = _geoFeatureSet.features()[i];
-					
-					std::string pattern = "," + feature->name() + ",";
-					if (_regionNames.find(pattern) == std::string::npos) {
-						SEISCOMP_DEBUG("Filter region %s not in bna file polygons %s", 
-							feature->name().c_str(),
-							_regionNames.c_str());
+				for (size_t i = 0; i < _regions.size(); ++i) {
+					const Region &region = _regions[i];
+					Seiscomp::Geo::GeoFeature *feature = region.feature;
+
+					if (!region.mayContain(epicenter.get_lat(), epicenter.get_lon()))
 						continue;
-					}
 
 					if (feature->contains(Seiscomp::Geo::Vertex(epicenter.get_lat(), epicenter.get_lon()))) {
 						validLatLon = true;
@@ -966,6 +1577,11 @@ class App : public Client::StreamApplication {
 				}
 			}
 
+			if ( !_replayFile.empty() && !_replayStats.firstAlert.valid() ) {
+				_replayStats.firstAlert = _referenceTime;
+				_replayStats.firstAlertOrigin = Core::Time(finder->get_origin_time());
+			}
+
 			double deltalon,deltalat, azi1, azi2;
 			Math::Geo::delazi_wgs84(epicenter.get_lat(),
 			                  epicenter.get_lon(), 
@@ -1226,8 +1842,8 @@ class App : public Client::StreamApplication {
 
 	private:
 		struct Amplitude {
-			Amplitude() {}
-			Amplitude(double v, const Core::Time &ts, const std::string &cha, bool cli, const std::string gu) : value(v), timestamp(ts), channel(cha), clipped(cli), gainunit(gu) {}
+			Amplitude() : value(0), channel(-1), clipped(false), gainunit(-1) {}
+			Amplitude(double v, const Core::Time &ts, NamePool::ID cha, bool cli, NamePool::ID gu) : value(v), timestamp(ts), channel(cha), clipped(cli), gainunit(gu) {}
 
 			bool operator==(const Amplitude &other) const {
 				return value == other.value && timestamp == other.timestamp;
@@ -1237,34 +1853,131 @@ class App : public Client::StreamApplication {
 				return value != other.value || timestamp != other.timestamp;
 			}
 
-			double      value;
-			Core::Time  timestamp;
-			std::string channel;
-			bool        clipped;
-			Core::Time  lastclipped;
-			string      gainunit;
+			double       value;
+			Core::Time   timestamp;
+			NamePool::ID channel;
+			bool         clipped;
+			Core::Time   lastclipped;
+			NamePool::ID gainunit;
 		};
 
 		typedef Ring<Amplitude> PGABuffer;
+		typedef MaximumQueue<Amplitude> PGAMaximum;
 
 		DEFINE_SMARTPOINTER(Buddy);
+
+		// Locations ordered by the timestamp of their maximum
+		typedef std::multimap<Core::Time, Buddy*> MaximumIndex;
+
 		struct Buddy : Core::BaseObject {
+			Buddy() : indexed(false), pgaIndex(-1), pgaListed(false), pgaDirty(true) {}
+
+			std::string     id;
 			SensorLocation *meta;
 			PGABuffer       pgas;
 			Amplitude       maxPGA;
-			std::map<std::string, std::string> gainunits;
 
-			bool updateMaximum(const Core::Time &minTime, const std::string preferredGainUnits);
+			// Maximum candidates of all buffered amplitudes and of the
+			// amplitudes in the preferred gain unit
+			PGAMaximum      maxCandidates;
+			PGAMaximum      preferredMaxCandidates;
+			// Timestamps of buffered clipped amplitudes and whether they
+			// are in the preferred gain unit
+			std::deque< std::pair<Core::Time, bool> > clips;
+
+			bool            indexed;
+			MaximumIndex::iterator maxIndex;
+
+			// Position of the maximum in the PGA list passed to FinDer or
+			// -1 if the location is not eligible
+			int             pgaIndex;
+			// Whether pgaIndex refers to the current PGA list
+			bool            pgaListed;
+			// Whether the maximum changed since it was added to the list
+			bool            pgaDirty;
+
+			bool feed(const Amplitude &ampl, NamePool::ID preferredGainUnit);
+			bool updateMaximum(const Core::Time &minTime, NamePool::ID preferredGainUnit);
+
+			private:
+				Core::Time lastClipped(const Core::Time &minTime, bool preferredOnly,
+				                       NamePool::ID preferredGainUnit) const;
 		};
 
+		bool updateMaximum(Buddy *buddy, const Core::Time &minTime);
+
 		// Mapping of id=net.sta.loc to SensorLocation object
 		typedef map<string, BuddyPtr> LocationLookup;
 
+		// A polygon of the region filter and its bounding box
+		struct Region {
+			Region(Seiscomp::Geo::GeoFeature *f)
+			: feature(f), latMin(90), latMax(-90), lonMin(180), lonMax(-180) {
+				const std::vector<Seiscomp::Geo::Vertex> &vertices = feature->vertices();
+				for ( size_t i = 0; i < vertices.size(); ++i ) {
+					latMin = min(latMin, (double)vertices[i].lat);
+					latMax = max(latMax, (double)vertices[i].lat);
+					lonMin = min(lonMin, (double)vertices[i].lon);
+					lonMax = max(lonMax, (double)vertices[i].lon);
+				}
+
+				// Polygons which might cross the date line are always tested
+				bounded = !vertices.empty() && lonMax - lonMin <= 180;
+			}
+
+			//! Returns false if the point lies outside the bounding box
+			bool mayContain(double lat, double lon) const {
+				if ( !bounded ) return true;
+				if ( lat < latMin || lat > latMax ) return false;
+				return (lon >= lonMin && lon <= lonMax)
+				    || (lon + 360 >= lonMin && lon + 360 <= lonMax)
+				    || (lon - 360 >= lonMin && lon - 360 <= lonMax);
+			}
+
+			Seiscomp::Geo::GeoFeature *feature;
+			double latMin, latMax;
+			double lonMin, lonMax;
+			bool   bounded;
+		};
+
+		// Resolved attributes of an envelope stream
+		struct StreamInfo {
+			StreamInfo() : buddy(NULL), channel(-1), gainUnit(-1), tick(-1) {}
+
+			Buddy       *buddy;
+			NamePool::ID channel;
+			NamePool::ID gainUnit;
+			// Latest envelope tick or -1
+			int64_t      tick;
+		};
+
+		typedef std::unordered_map<const Processing::EEWAmps::BaseProcessor*, StreamInfo> StreamLookup;
+
+		// Number of streams per latest envelope tick
+		typedef map<int64_t, int> TickCounts;
+
+		// Statistics of an envelope replay
+		struct ReplayStats {
+			ReplayStats() : values(0), scans(0), ticks(0), cpuTotal(0), cpuMax(0) {}
+
+			size_t     values;
+			// Number of Finder::Scan_Data calls
+			size_t     scans;
+			size_t     ticks;
+			// CPU time in seconds
+			double     cpuTotal;
+			double     cpuMax;
+			Core::Time firstEnvelope;
+			Core::Time firstAlert;
+			Core::Time firstAlertOrigin;
+		};
+
 		bool                           _testMode;
 		bool                           _playbackMode;
 		std::string                    _strTs;
 		std::string                    _strTe;
 		std::string                    _strMask;
+		std::string                    _replayFile;
 		std::string                    _magnitudeGroup;
 		std::string                    _strongMotionGroup;
 		std::string                    _finderConfig;
@@ -1292,57 +2005,145 @@ class App : public Client::StreamApplication {
 		bool                           _finderAmplitudesDirty;
 		bool                           _finderScanDataDirty;
 
+		bool                           _tickScheduling;
+		Core::TimeSpan                 _tickLatency;
+		int64_t                        _tickLength;
+		int64_t                        _lastTick;
+		int64_t                        _nextTick;
+		bool                           _ticksStarted;
+		StreamLookup                   _streams;
+		TickCounts                     _streamsPerTick;
+		int                            _finderThreads;
+		ReplayStats                    _replayStats;
+
 		LocationLookup                 _locationLookup;
+		MaximumIndex                   _maximumIndex;
+		Core::Time                     _minAmplTime;
 		Finder_List                    _finderList;
 		PGA_Data_List                  _latestMaxPGAs;
 		std::string                    _preferredGainUnits;
+		NamePool::ID                   _preferredGainUnit;
+		NamePool                       _channelCodes;
+		NamePool                       _gainUnits;
 
 		std::string                    _regionFile;
 		std::string                    _regionNames;
 		Seiscomp::Geo::GeoFeatureSet   _geoFeatureSet;
+		std::vector<Region>            _regions;
 };
 
 
-bool App::Buddy::updateMaximum(const Core::Time &minTime, const std::string preferredGainUnits) {
+bool App::Buddy::feed(const Amplitude &ampl, NamePool::ID preferredGainUnit) {
+	if ( !pgas.feed(ampl) )
+		return false;
+
+	bool preferred = preferredGainUnit >= 0 && ampl.gainunit == preferredGainUnit;
+
+	maxCandidates.feed(ampl);
+	if ( preferred )
+		preferredMaxCandidates.feed(ampl);
+
+	if ( ampl.clipped ) {
+		std::deque< std::pair<Core::Time, bool> >::iterator it = clips.end();
+		while ( it != clips.begin() && ampl.timestamp < (it-1)->first )
+			--it;
+		clips.insert(it, std::make_pair(ampl.timestamp, preferred));
+	}
+
+	// Expire everything that dropped out of the buffer
+	Core::Time tmin = pgas.firstTime();
+	maxCandidates.expire(tmin);
+	preferredMaxCandidates.expire(tmin);
+	while ( !clips.empty() && clips.front().first < tmin )
+		clips.pop_front();
+
+	return true;
+}
+
+
+bool App::Buddy::updateMaximum(const Core::Time &minTime, NamePool::ID preferredGainUnit) {
 	Amplitude lastMaximum = maxPGA;
 	maxPGA = Amplitude();
 
-	if ( !pgas.empty() && pgas.back().timestamp >= minTime ) {
-		// Update maxmimum
-		PGABuffer::iterator it;
-		for ( it = pgas.begin(); it != pgas.end(); ++it ) {
-
-			// Skip if value is smaller or outdated.
-			if ( it->timestamp < minTime ) continue;
-			if ( maxPGA.timestamp.valid() && it->value < maxPGA.value ) continue;			
-
-			// Skip if gain unit does not match the configured prevailing 
-			// (default M/S**2) but lastMaximum already does.
-			if ( !preferredGainUnits.empty() 
-			     && ( strcmp( lastMaximum.gainunit.c_str(), preferredGainUnits.c_str() ) == 0 ) 
-				 && ( strcmp( it->gainunit.c_str(), preferredGainUnits.c_str() ) != 0 ) ) {
-
-					// SEISCOMP_DEBUG("%s [%s] rules over %s [%s]",
-					// 				lastMaximum.channel.c_str(),
-					// 				lastMaximum.gainunit.c_str(),
-					// 				it->channel.c_str(),
-					// 				it->gainunit.c_str() );
-					continue;
-			}
-
-			maxPGA.timestamp = it->timestamp;
-			maxPGA.value = it->value;
-			maxPGA.channel = it->channel;
-			maxPGA.gainunit = it->gainunit;
-
-			// If clipped, update latest clipped timestamp
-			if ( !it->clipped ) continue ;
-			if ( maxPGA.lastclipped > it->timestamp ) continue ;			
-			maxPGA.lastclipped = it->timestamp;
-		}
+	// Skip amplitudes whose gain unit does not match the configured
+	// prevailing (default M/S**2) if lastMaximum already does.
+	bool preferredOnly = preferredGainUnit >= 0
+	                  && lastMaximum.gainunit == preferredGainUnit;
+
+	const PGAMaximum &candidates = preferredOnly ? preferredMaxCandidates : maxCandidates;
+	PGAMaximum::const_iterator it = candidates.find(minTime);
+	if ( it != candidates.end() ) {
+		maxPGA.timestamp = it->timestamp;
+		maxPGA.value = it->value;
+		maxPGA.channel = it->channel;
+		maxPGA.gainunit = it->gainunit;
+		maxPGA.lastclipped = lastClipped(minTime, preferredOnly, preferredGainUnit);
+	}
+
+	bool changed = maxPGA != lastMaximum;
+	if ( changed || maxPGA.channel != lastMaximum.channel )
+		pgaDirty = true;
+
+	return changed;
+}
+
+
+Core::Time App::Buddy::lastClipped(const Core::Time &minTime, bool preferredOnly,
+                                   NamePool::ID preferredGainUnit) const {
+	// The latest clipped amplitude which has been the running maximum of
+	// the time window when going forward in time. Clipping is rare so the
+	// buffer is only scanned if a clipped amplitude lies before the maximum.
+	bool hasClips = false;
+	for ( size_t i = clips.size(); i > 0; --i ) {
+		if ( clips[i-1].first < minTime ) break;
+		if ( clips[i-1].first > maxPGA.timestamp ) continue;
+		if ( preferredOnly && !clips[i-1].second ) continue;
+		hasClips = true;
+		break;
+	}
+
+	if ( !hasClips )
+		return Core::Time();
+
+	Core::Time lastclipped;
+	Amplitude running;
+
+	pgas.forEach([&](const Amplitude &ampl) {
+		// Skip if value is smaller or outdated.
+		if ( ampl.timestamp < minTime ) return;
+		if ( preferredOnly && ampl.gainunit != preferredGainUnit ) return;
+		if ( running.timestamp.valid() && ampl.value < running.value ) return;
+
+		running.timestamp = ampl.timestamp;
+		running.value = ampl.value;
+
+		// If clipped, update latest clipped timestamp
+		if ( ampl.clipped )
+			lastclipped = ampl.timestamp;
+	});
+
+	return lastclipped;
+}
+
+
+bool App::updateMaximum(Buddy *buddy, const Core::Time &minTime) {
+	bool changed = buddy->updateMaximum(minTime, _preferredGainUnit);
+
+	if ( buddy->indexed ) {
+		_maximumIndex.erase(buddy->maxIndex);
+		buddy->indexed = false;
+	}
+
+	// A location without maximum only needs to be revisited on the next
+	// reference time update if it just lost its maximum: the gain unit
+	// rule then considers all amplitudes again. Otherwise only new
+	// amplitudes can create a maximum.
+	if ( buddy->maxPGA.timestamp.valid() || changed ) {
+		buddy->maxIndex = _maximumIndex.insert(std::make_pair(buddy->maxPGA.timestamp, buddy));
+		buddy->indexed = true;
 	}
 
-	return maxPGA != lastMaximum;
+	return changed;
 }
 
 
@@ -18,9 +18,113 @@
 
 #include "Vs30Mapping.h"
 
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace ch {
 namespace sed {
 
+namespace {
+
+const char RasterMagic[8] = { 'V', 'S', '3', '0', 'R', 'A', 'S', '1' };
+
+/*
+ Determine origin, spacing and number of points of a regular grid axis from
+ the sorted distinct coordinates of the grid points. The spacing is averaged
+ over the whole axis since the coordinates in the grid files are rounded.
+ Returns false if the coordinates do not lie on a regular axis.
+ */
+bool regularAxis(const std::vector<float> &values, double &origin,
+		double &step, size_t &count) {
+	origin = values.front();
+	if ( values.size() == 1 ) {
+		step = 1;
+		count = 1;
+		return true;
+	}
+
+	std::vector<float> diffs;
+	for ( size_t i = 1; i < values.size(); ++i )
+		diffs.push_back(values[i] - values[i - 1]);
+
+	std::vector<float> sorted(diffs);
+	std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2,
+			sorted.end());
+	double approx = sorted[sorted.size() / 2];
+	if ( !(approx > 0) )
+		return false;
+
+	long steps = 0;
+	for ( size_t i = 0; i < diffs.size(); ++i )
+		steps += lround(diffs[i] / approx);
+	if ( steps <= 0 )
+		return false;
+
+	step = (values.back() - origin) / steps;
+	count = steps + 1;
+
+	for ( size_t i = 0; i < values.size(); ++i ) {
+		long idx = lround((values[i] - origin) / step);
+		if ( fabs(values[i] - (origin + idx * step)) > 0.25 * step )
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ Look up the Vs30 value of a coordinate in a regular grid of values where 0
+ marks a grid point without value. With bilinear interpolation all four
+ surrounding grid points must have a value, otherwise the nearest grid point
+ is taken which has to be closer than 0.1 degrees.
+ */
+template <typename T>
+bool regularLookup(const Vs30Mapping::RegularGrid &grid, const T *values,
+		double lat, double lon, bool bilinear, float &vsx) {
+	double y = (lat - grid.lat0) / grid.dlat;
+	double x = (lon - grid.lon0) / grid.dlon;
+
+	if ( bilinear ) {
+		long row = (long) floor(y);
+		long col = (long) floor(x);
+		if ( row >= 0 && row + 1 < (long)grid.rows && col >= 0
+				&& col + 1 < (long)grid.cols ) {
+			const T *v = values + (size_t)row * grid.cols + col;
+			float v00 = v[0], v01 = v[1];
+			float v10 = v[grid.cols], v11 = v[grid.cols + 1];
+			if ( v00 > 0 && v01 > 0 && v10 > 0 && v11 > 0 ) {
+				double wy = y - row;
+				double wx = x - col;
+				vsx = (1 - wy) * ((1 - wx) * v00 + wx * v01)
+				    + wy * ((1 - wx) * v10 + wx * v11);
+				return true;
+			}
+		}
+	}
+
+	long row = lround(y);
+	long col = lround(x);
+	if ( row < 0 || row >= (long)grid.rows || col < 0
+			|| col >= (long)grid.cols )
+		return false;
+
+	float v = values[(size_t)row * grid.cols + col];
+	// station should be close to a grid point
+	if ( v > 0 && fabs(lat - (grid.lat0 + row * grid.dlat)) < 0.1
+			&& fabs(lon - (grid.lon0 + col * grid.dlon)) < 0.1 ) {
+		vsx = v;
+		return true;
+	}
+
+	return false;
+}
+
+}
+
 Vs30Mapping::Tuple::Tuple(float lat, float lon, float vsx) {
 	_lat = lat;
 	_lon = lon;
@@ -79,6 +183,10 @@ void Vs30Mapping::TupleHandler::setVsDefault(float val) {
 	_vsdefault = val;
 }
 
+void Vs30Mapping::TupleHandler::setBilinear(bool bilinear) {
+	_bilinear = bilinear;
+}
+
 float Vs30Mapping::TupleHandler::getVs(double lat, double lon) {
 
 	SEISCOMP_DEBUG("lat: %.2f, lon: %.2f", lat, lon);
@@ -126,10 +234,6 @@ bool Vs30Mapping::TupleHandlerGrid::read() {
 					"Longitude must be equal or smaller than +180 (lon=%.2f)", lon);
 			return false;
 		}
-		if ( !(lon >= oldlon) ) {
-			SEISCOMP_ERROR("Longitudes must increase continuously");
-			return false;
-		}
 		if ( !(-90 <= lat) ) {
 			SEISCOMP_ERROR(
 					"Latitude must be equal or greater than -90 (lat=%.2f)", lat);
@@ -140,10 +244,6 @@ bool Vs30Mapping::TupleHandlerGrid::read() {
 					"Latitude must be equal or smaller than +90 (lat=%.2f)", lat);
 			return false;
 		}
-		if ( !(lat >= oldlat) ) {
-			SEISCOMP_ERROR("Latitudes must increase continuously");
-			return false;
-		}
 		if ( !(150 <= vsx) ) {
 			SEISCOMP_ERROR(
 					"Vs30 values must be equal or greater than 150 m/s. (Vs30 = %.2f m/s)", vsx);
@@ -156,110 +256,256 @@ bool Vs30Mapping::TupleHandlerGrid::read() {
 		}
 
 		if ( oldlat == lat ) {
-			oldlon = lon;
+			if ( !(lon > oldlon) ) {
+				SEISCOMP_ERROR("Longitudes must increase continuously");
+				return false;
+			}
 		}
 		else {
+			if ( !(lat > oldlat) ) {
+				SEISCOMP_ERROR("Latitudes must increase continuously");
+				return false;
+			}
 			_rowidx.push_back(_tuplelist.size() - 1); // remember begin of new row
-			oldlon = lon;
-			oldlat = -std::numeric_limits<float>::max();
+			oldlat = lat;
 		}
+		oldlon = lon;
 	}
+
+	_rowidx.push_back(_tuplelist.size());
+	makeRegular();
+
 	return true; // successfully read
 }
 
-float Vs30Mapping::TupleHandlerGrid::getRow(double lat, double lon, size_t l,
-		size_t r) {
-	if ( !(l < _rowidx.size()) ) {
-		SEISCOMP_ERROR(
-				"Line index exceeds the number of rows. (line index=%d, number of rows=%d)", (int)l, (int) _rowidx.size());
-		return -1;
+void Vs30Mapping::TupleHandlerGrid::makeRegular() {
+	_regular = false;
+	if ( _tuplelist.empty() )
+		return;
+
+	std::vector<float> lats, lons;
+	for ( size_t i = 0; i < _tuplelist.size(); ++i ) {
+		lats.push_back(_tuplelist[i]._lat);
+		lons.push_back(_tuplelist[i]._lon);
 	}
-	if ( !(r < _rowidx.size() && (l <= r)) ) {
-		SEISCOMP_ERROR(
-				"Row index exceeds the number of rows or line index is greater than row index. (line index=%d, row index=%d, number of rows=%d)", (int)l, (int)r, (int)_rowidx.size());
-		return -1;
+	std::sort(lats.begin(), lats.end());
+	lats.erase(std::unique(lats.begin(), lats.end()), lats.end());
+	std::sort(lons.begin(), lons.end());
+	lons.erase(std::unique(lons.begin(), lons.end()), lons.end());
+
+	if ( !regularAxis(lats, _grid.lat0, _grid.dlat, _grid.rows)
+	  || !regularAxis(lons, _grid.lon0, _grid.dlon, _grid.cols) ) {
+		SEISCOMP_DEBUG("Vs30 grid points do not lie on a regular grid");
+		return;
 	}
 
-	if ( 0 == (r - l) ) {
-		return l;
+	// Do not blow up sparse grids
+	if ( _grid.rows * _grid.cols > 4 * _tuplelist.size() ) {
+		SEISCOMP_DEBUG("Vs30 grid is too sparse for a regular grid");
+		return;
 	}
 
-	if ( 1 == (r - l) ) {
-		float vl = fabs(_tuplelist.at(_rowidx.at(l))._lat - lat);
-		float vr = fabs(_tuplelist.at(_rowidx.at(r))._lat - lat);
-		if ( vl < vr ) {
-			return l;
-		} else {
-			return r;
-		}
+	_values.assign(_grid.rows * _grid.cols, 0);
+	for ( size_t i = 0; i < _tuplelist.size(); ++i ) {
+		const Tuple &t = _tuplelist[i];
+		long row = lround((t._lat - _grid.lat0) / _grid.dlat);
+		long col = lround((t._lon - _grid.lon0) / _grid.dlon);
+		_values[row * _grid.cols + col] = t._vsx;
 	}
 
-	int k = l + (r - l) / 2;
+	_regular = true;
+	std::vector<Tuple>().swap(_tuplelist);
+	std::vector<size_t>().swap(_rowidx);
 
-	Vs30Mapping::Tuple * p = &(_tuplelist.at(_rowidx.at(k)));
-	if ( lat < p->_lat ) {
-		return getRow(lat, lon, l, k);
-	} else {
-		return getRow(lat, lon, k, r);
+	SEISCOMP_DEBUG(
+			"Vs30 grid is regular with %d rows and %d columns", (int)_grid.rows, (int)_grid.cols);
+}
+
+size_t Vs30Mapping::TupleHandlerGrid::getRow(double lat) const {
+	// Binary search for the first row with a latitude not smaller than lat
+	size_t l = 0, r = _rowidx.size() - 1;
+	while ( l < r ) {
+		size_t k = l + (r - l) / 2;
+		if ( _tuplelist[_rowidx[k]]._lat < lat )
+			l = k + 1;
+		else
+			r = k;
 	}
+
+	// Take the closer one of this and the previous row
+	if ( l == _rowidx.size() - 1 )
+		return l - 1;
+	if ( l > 0 && fabs(_tuplelist[_rowidx[l - 1]]._lat - lat)
+			< fabs(_tuplelist[_rowidx[l]]._lat - lat) )
+		return l - 1;
+	return l;
 }
 
-float Vs30Mapping::TupleHandlerGrid::getCol(double lat, double lon, size_t l,
-		size_t r) {
-	if ( !(l < _tuplelist.size()) ) {
-		SEISCOMP_ERROR(
-				"Line index exceeds the number of lines. (line index=%d, number of lines=%d)", (int)l, (int)_tuplelist.size());
-		return -1;
+size_t Vs30Mapping::TupleHandlerGrid::getCol(double lon, size_t first,
+		size_t last) const {
+	// Binary search for the first point with a longitude not smaller
+	// than lon
+	size_t l = first, r = last;
+	while ( l < r ) {
+		size_t k = l + (r - l) / 2;
+		if ( _tuplelist[k]._lon < lon )
+			l = k + 1;
+		else
+			r = k;
 	}
-	if ( !(r < _tuplelist.size() && (l <= r)) ) {
-		SEISCOMP_ERROR(
-				"Row index exceeds the number of lines or line index is greater than row index. (line index=%d, row index=%d, number of lines=%d)", (int)l, (int)r, (int)_tuplelist.size());
-		return -1;
+
+	// Take the closer one of this and the previous point
+	if ( l == last )
+		return l - 1;
+	if ( l > first && fabs(_tuplelist[l - 1]._lon - lon)
+			< fabs(_tuplelist[l]._lon - lon) )
+		return l - 1;
+	return l;
+}
+
+float Vs30Mapping::TupleHandlerGrid::getVs(double lat, double lon) {
+	float vsx;
+
+	if ( _regular ) {
+		if ( regularLookup(_grid, &_values[0], lat, lon, _bilinear, vsx) )
+			return vsx;
 	}
+	else if ( !_tuplelist.empty() ) {
+		size_t row = getRow(lat);
+		const Tuple &p = _tuplelist[getCol(lon, _rowidx[row], _rowidx[row + 1])];
 
-	/*
-	 SEISCOMP_DEBUG("line=%d, row=%d",(int)l,(int)r);
-	 SEISCOMP_DEBUG("%s",_tuplelist.at(l).toString().c_str());
-	 SEISCOMP_DEBUG("%s",_tuplelist.at(r).toString().c_str());
-	 */
+		// station should be close to a grid point now
+		if ( (fabs(lat - p._lat) < 0.1) && (fabs(lon - p._lon) < 0.1) )
+			return p._vsx;
+	}
+
+	// not found; return some default value
+	return TupleHandler::getVs(lat, lon);
+}
 
-	if ( 0 == (r - l) ) {
-		return l;
+bool Vs30Mapping::TupleHandlerGrid::writeRaster(
+		const std::string &filename) const {
+	if ( !_regular ) {
+		SEISCOMP_ERROR("Vs30 grid points do not lie on a regular grid");
+		return false;
 	}
 
-	if ( 1 == (r - l) ) {
-		float vl = fabs(_tuplelist.at(l)._lon - lon);
-		float vr = fabs(_tuplelist.at(r)._lon - lon);
-		if ( vl < vr ) {
-			return l;
-		} else {
-			return r;
-		}
+	TupleHandlerRaster::Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RasterMagic, sizeof(header.magic));
+	header.rows = _grid.rows;
+	header.cols = _grid.cols;
+	header.lat0 = _grid.lat0;
+	header.lon0 = _grid.lon0;
+	header.dlat = _grid.dlat;
+	header.dlon = _grid.dlon;
+
+	std::vector<uint16_t> values(_values.size());
+	for ( size_t i = 0; i < _values.size(); ++i )
+		values[i] = (uint16_t) lround(_values[i]);
+
+	std::ofstream ofs(filename.c_str(), std::ios::out | std::ios::binary);
+	if ( !ofs ) {
+		SEISCOMP_ERROR("couldn't open %s", filename.c_str());
+		return false;
 	}
 
-	int k = l + (r - l) / 2;
-	Tuple * p = &(_tuplelist.at(k));
-	if ( lon < p->_lon ) {
-		return getCol(lat, lon, l, k);
-	} else {
-		return getCol(lat, lon, k, r);
+	ofs.write((const char*) &header, sizeof(header));
+	ofs.write((const char*) &values[0], values.size() * sizeof(uint16_t));
+	if ( !ofs ) {
+		SEISCOMP_ERROR("errors while writing file %s", filename.c_str());
+		return false;
 	}
+
+	SEISCOMP_INFO(
+			"Wrote Vs30 raster %s with %d rows and %d columns", filename.c_str(), (int)_grid.rows, (int)_grid.cols);
+	return true;
 }
 
-float Vs30Mapping::TupleHandlerGrid::getVs(double lat, double lon) {
-	int row = getRow(lat, lon, 0, _rowidx.size() - 1);
-	int col = getCol(lat, lon, _rowidx.at(row), _rowidx.at(row + 1) - 1)
-			- _rowidx.at(row);
+Vs30Mapping::TupleHandlerRaster::TupleHandlerRaster() {
+	_map = NULL;
+	_mapSize = 0;
+	_values = NULL;
+}
 
-	Vs30Mapping::Tuple * p = &(_tuplelist.at(_rowidx.at(row) + col));
+Vs30Mapping::TupleHandlerRaster::~TupleHandlerRaster() {
+	if ( _map != NULL )
+		munmap(_map, _mapSize);
+}
 
-	if ( true ) {
-		// station should be close to a grid point now
-		if ( (fabs(lat - p->_lat) < 0.1) && (fabs(lon - p->_lon) < 0.1) ) {
-			return p->_vsx;
-		}
+bool Vs30Mapping::TupleHandlerRaster::isRaster(const std::string &filename) {
+	std::ifstream ifs(filename.c_str(), std::ios::in | std::ios::binary);
+	char magic[sizeof(RasterMagic)];
+	if ( !ifs.read(magic, sizeof(magic)) )
+		return false;
+	return memcmp(magic, RasterMagic, sizeof(magic)) == 0;
+}
+
+bool Vs30Mapping::TupleHandlerRaster::load(std::string filename) {
+	_vsdefault = -1;
+
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if ( fd < 0 ) {
+		SEISCOMP_ERROR("couldn't open %s", filename.c_str());
+		return false;
 	}
 
+	struct stat st;
+	if ( fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header) ) {
+		SEISCOMP_ERROR("%s is not a Vs30 raster file", filename.c_str());
+		::close(fd);
+		return false;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if ( map == MAP_FAILED ) {
+		SEISCOMP_ERROR("couldn't map %s", filename.c_str());
+		return false;
+	}
+
+	_map = map;
+	_mapSize = st.st_size;
+	const Header *header = (const Header*) _map;
+
+	if ( memcmp(header->magic, RasterMagic, sizeof(RasterMagic)) != 0 ) {
+		SEISCOMP_ERROR("%s is not a Vs30 raster file", filename.c_str());
+		return false;
+	}
+
+	if ( _mapSize < sizeof(Header)
+			+ (size_t)header->rows * header->cols * sizeof(uint16_t) ) {
+		SEISCOMP_ERROR("Vs30 raster file %s is truncated", filename.c_str());
+		return false;
+	}
+
+	if ( !(header->dlat > 0) || !(header->dlon > 0) ) {
+		SEISCOMP_ERROR(
+				"Vs30 raster file %s has an invalid grid spacing", filename.c_str());
+		return false;
+	}
+
+	_grid.lat0 = header->lat0;
+	_grid.lon0 = header->lon0;
+	_grid.dlat = header->dlat;
+	_grid.dlon = header->dlon;
+	_grid.rows = header->rows;
+	_grid.cols = header->cols;
+	_values = (const uint16_t*) ((const char*) _map + sizeof(Header));
+	return true;
+}
+
+bool Vs30Mapping::TupleHandlerRaster::read() {
+	// The raster is mapped by load()
+	return false;
+}
+
+float Vs30Mapping::TupleHandlerRaster::getVs(double lat, double lon) {
+	float vsx;
+	if ( _values != NULL
+			&& regularLookup(_grid, _values, lat, lon, _bilinear, vsx) )
+		return vsx;
+
 	// not found; return some default value
 	return TupleHandler::getVs(lat, lon);
 }
@@ -290,6 +536,10 @@ void Vs30Mapping::setVsDefault(int vstype, float val) {
 	_vsxmappingP->_tuplehandlerP->setVsDefault(val);
 }
 
+void Vs30Mapping::setBilinear(bool bilinear) {
+	_vsxmappingP->_tuplehandlerP->setBilinear(bilinear);
+}
+
 float Vs30Mapping::getVs(int vstype, double lat, double lon) {
 	if ( !(TYPE_VS30 == vstype) ) {
 		SEISCOMP_ERROR("Only Vs30 correction supported.");
@@ -313,7 +563,10 @@ Vs30Mapping * Vs30Mapping::createInstance(std::string filename) {
 
 	_vsxmappingP = new Vs30Mapping(); // NEW_MEM
 
-	_vsxmappingP->_tuplehandlerP = new TupleHandlerGrid(); // NEW_MEM
+	if ( TupleHandlerRaster::isRaster(filename) )
+		_vsxmappingP->_tuplehandlerP = new TupleHandlerRaster(); // NEW_MEM
+	else
+		_vsxmappingP->_tuplehandlerP = new TupleHandlerGrid(); // NEW_MEM
 	if ( _vsxmappingP->_tuplehandlerP->load(filename) ) {
 		return _vsxmappingP;
 	} else {
@@ -321,6 +574,13 @@ Vs30Mapping * Vs30Mapping::createInstance(std::string filename) {
 	}
 }
 
+bool Vs30Mapping::convert(std::string gridfile, std::string rasterfile) {
+	TupleHandlerGrid grid;
+	if ( !grid.load(gridfile) )
+		return false;
+	return grid.writeRaster(rasterfile);
+}
+
 Vs30Mapping * Vs30Mapping::sharedInstance() {
 	if ( (NULL == _vsxmappingP) ) {
 		SEISCOMP_ERROR("Instance has not been created.");
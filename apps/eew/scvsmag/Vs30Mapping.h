@@ -23,6 +23,7 @@
 #include <vector>
 #include <math.h>
 #include <limits>
+#include <stdint.h>
 
 #include <seiscomp/logging/log.h>
 #include <seiscomp/core/strings.h>
@@ -51,11 +52,26 @@ public:
 		std::string toString();
 	};
 
+	/**
+	 \brief Geometry of a grid with uniform spacing. Row r and column c
+	 is located at lat0 + r * dlat and lon0 + c * dlon.
+	 */
+	struct RegularGrid {
+		double lat0;
+		double lon0;
+		double dlat;
+		double dlon;
+		size_t rows;
+		size_t cols;
+	};
+
 	/**
 	 \brief Interface definiton.
 	 */
 	class TupleHandler {
 	public:
+		TupleHandler()
+		: _vsdefault(-1), _bilinear(false), _isP(NULL), _fbP(NULL) {}
 		virtual ~TupleHandler() {}
 	protected:
 
@@ -65,6 +81,12 @@ public:
 		 */
 		float _vsdefault;
 
+		/**
+		 Interpolate bilinearly between the four surrounding grid points
+		 instead of taking the nearest one. Only supported by regular grids.
+		 */
+		bool _bilinear;
+
 		std::istream * _isP;
 		std::filebuf * _fbP;
 
@@ -84,6 +106,7 @@ public:
 		//
 		virtual float getVsDefault();
 		virtual void setVsDefault(float val);
+		virtual void setBilinear(bool bilinear);
 
 		/**
 		 Return the Vs30 value for the given coordiante. If not overloaded
@@ -97,16 +120,76 @@ public:
 	 */
 	class TupleHandlerGrid: public TupleHandler {
 	private:
+		// Grid points of irregular grids and the index of the first
+		// point of each row followed by the number of points
 		std::vector<Tuple> _tuplelist;
 		std::vector<size_t> _rowidx;
 
+		// If the points lie on a regular grid (missing points are allowed)
+		// they are stored in a dense array instead with 0 for points
+		// without value.
+		bool _regular;
+		RegularGrid _grid;
+		std::vector<float> _values;
+
 		virtual bool read();
 
-		float getRow(double lat, double lon, size_t l, size_t r);
-		float getCol(double lat, double lon, size_t l, size_t r);
+		//! Detects a regular grid and converts the points to _values
+		void makeRegular();
+
+		size_t getRow(double lat) const;
+		size_t getCol(double lon, size_t first, size_t last) const;
+
+	public:
+		TupleHandlerGrid() : _regular(false) {}
+
+		virtual float getVs(double lat, double lon);
+
+		/**
+		 Write the grid as binary raster (see TupleHandlerRaster). The
+		 grid points must lie on a regular grid, missing points are
+		 allowed.
+		 */
+		bool writeRaster(const std::string &filename) const;
+	};
+
+	/**
+	 \brief Handler for binary Vs30 raster files.
 
+	 The file starts with a Header followed by rows * cols Vs30 values in
+	 m/s stored as unsigned 16 bit integers in native byte order. Rows are
+	 ordered by increasing latitude and longitudes increase within a row.
+	 A value of 0 marks a cell without Vs30 value. The file is memory
+	 mapped and the cell of a coordinate is found by index arithmetic.
+	 */
+	class TupleHandlerRaster: public TupleHandler {
 	public:
+		struct Header {
+			char magic[8];
+			uint32_t rows;
+			uint32_t cols;
+			double lat0;
+			double lon0;
+			double dlat;
+			double dlon;
+		};
+
+		TupleHandlerRaster();
+		virtual ~TupleHandlerRaster();
+
+		//! Return whether a file starts with the raster magic
+		static bool isRaster(const std::string &filename);
+
+		virtual bool load(std::string filename);
 		virtual float getVs(double lat, double lon);
+
+	private:
+		virtual bool read();
+
+		void *_map;
+		size_t _mapSize;
+		RegularGrid _grid;
+		const uint16_t *_values;
 	};
 
 	/**
@@ -144,6 +227,13 @@ public:
 	void setVsDefault(int vstype, float val);
 	float getVsDefault(int vstype);
 
+	/**
+	 Enables bilinear interpolation between grid points. Grid files
+	 whose points do not lie on a regular grid always use the nearest
+	 grid point.
+	 */
+	void setBilinear(bool bilinear);
+
 	/**
 	 Return the Vs30 value for the given coordinate. If the default value
 	 is negative, the default value is always returned and no lookup
@@ -154,8 +244,8 @@ public:
 	/**
 	 Create a singleton instance with vs30 values.
 
-	 Only one file type is supported:
-	 grid format: predefined Vs30 mapping are available from
+	 Two file types are supported, a binary raster written by convert()
+	 and the grid format: predefined Vs30 mapping are available from
 	 http://earthquake.usgs.gov/hazards/apps/vs30/predefined.php, 
 	 e.g., California.xyz:
 	 \code
@@ -167,6 +257,12 @@ public:
 	 */
 	static Vs30Mapping * createInstance(std::string filename);
 
+	/**
+	 Convert a Vs30 grid file into a binary raster file which is
+	 loaded much faster by createInstance().
+	 */
+	static bool convert(std::string gridfile, std::string rasterfile);
+
 	/**
 	 Return pointer to the singleton instance.
 	 */
@@ -0,0 +1,93 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ ***************************************************************************/
+
+#define SEISCOMP_COMPONENT VsMagnitude
+
+#include "asynclog.h"
+
+namespace Seiscomp {
+
+AsyncLog::AsyncLog()
+: _running(false), _shutdown(false) {}
+
+AsyncLog::~AsyncLog() {
+	stop();
+}
+
+void AsyncLog::start() {
+	stop();
+
+	_shutdown = false;
+	_running = true;
+	_thread = std::thread(&AsyncLog::run, this);
+}
+
+void AsyncLog::stop() {
+	if ( !_running )
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_shutdown = true;
+	}
+	_wakeup.notify_one();
+
+	_thread.join();
+	_running = false;
+}
+
+void AsyncLog::post(Logging::Channel *channel, const Formatter &formatter) {
+	if ( channel == NULL )
+		return;
+
+	if ( !_running ) {
+		SEISCOMP_LOG(channel, "%s", formatter().c_str());
+		return;
+	}
+
+	Message msg = { channel, formatter };
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_queue.push_back(msg);
+	}
+	_wakeup.notify_one();
+}
+
+void AsyncLog::post(Logging::Channel *channel, const std::string &message) {
+	post(channel, [message] { return message; });
+}
+
+void AsyncLog::run() {
+	std::deque<Message> messages;
+
+	while ( true ) {
+		bool shutdown;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wakeup.wait(lock, [this] { return _shutdown || !_queue.empty(); });
+			messages.swap(_queue);
+			shutdown = _shutdown;
+		}
+
+		for ( size_t i = 0; i < messages.size(); ++i )
+			SEISCOMP_LOG(messages[i].channel, "%s",
+			             messages[i].formatter().c_str());
+		messages.clear();
+
+		if ( shutdown )
+			return;
+	}
+}
+
+}
@@ -0,0 +1,76 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ ***************************************************************************/
+
+#ifndef __SEISCOMP_APPLICATIONS_SCVSMAG_ASYNCLOG_H__
+#define __SEISCOMP_APPLICATIONS_SCVSMAG_ASYNCLOG_H__
+
+#include <seiscomp/logging/log.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace Seiscomp {
+
+/**
+ \brief Writes log messages from a background thread.
+
+ Messages are posted as functions that format the message. They are called
+ in order by the background thread which also writes the formatted message
+ to its log channel. The posting thread therefore neither pays for the
+ formatting nor for the output. A formatter must only capture copies of the
+ data it needs.
+ */
+class AsyncLog {
+public:
+	typedef std::function<std::string()> Formatter;
+
+	AsyncLog();
+	~AsyncLog();
+
+	//! Starts the background thread. Without it messages are formatted and
+	//! written immediately by post().
+	void start();
+
+	//! Writes all pending messages and joins the background thread.
+	void stop();
+
+	//! Queues a message for a channel. Nothing is done if channel is NULL.
+	void post(Logging::Channel *channel, const Formatter &formatter);
+
+	//! Queues an already formatted message.
+	void post(Logging::Channel *channel, const std::string &message);
+
+private:
+	struct Message {
+		Logging::Channel *channel;
+		Formatter formatter;
+	};
+
+	void run();
+
+	std::thread _thread;
+	std::mutex _mutex;
+	std::condition_variable _wakeup;
+	std::deque<Message> _queue;
+	bool _running;
+	bool _shutdown;
+};
+
+}
+
+#endif
@@ -180,6 +180,136 @@ float VsEquations::likelihood(float ZA, float ZV, float ZD, float HA, float HV,
 	return f1 + f2;
 }
 
+namespace {
+
+// The type returned by log10 for a float argument. The logarithms of the
+// envelopes are stored as double in StationTerms and converted back to this
+// type so that gridsearch() computes exactly the same values as likelihood().
+typedef decltype(log10(float())) LogType;
+
+/*!
+ \brief Magnitude dependent terms of the likelihood for all magnitudes of
+ the grid search.
+
+ The magnitudes are generated in the same way as the original grid search
+ loop by accumulating steps of 0.01 in single precision.
+ */
+struct MagnitudeGrid {
+	MagnitudeGrid() {
+		VsEquations vs;
+		float mag = 0.5f;
+		while ( mag <= 9.0f ) {
+			vs.setmag(mag);
+			mags.push_back(mag);
+			for ( int ps = 0; ps < 2; ++ps ) {
+				zavg[ps].push_back(vs.zavg(ps));
+				for ( int wt = 0; wt < 6; ++wt ) {
+					for ( int soil = 0; soil < 2; ++soil )
+						saturation[ps][wt][soil].push_back(vs.saturation(
+							vs.getc1(ps, wt, soil), vs.getc2(ps, wt, soil)));
+				}
+			}
+			mag += 0.01f;
+		}
+	}
+
+	std::vector<float> mags;
+	std::vector<float> zavg[2];
+	std::vector<float> saturation[2][6][2];
+};
+
+const MagnitudeGrid &magnitudeGrid() {
+	static const MagnitudeGrid grid;
+	return grid;
+}
+
+}
+
+/*!
+ \brief Computes all terms of the likelihood of a station that do not
+ depend on the magnitude.
+ */
+VsEquations::StationTerms VsEquations::stationterms(float ZA, float ZV,
+		float ZD, float HA, float HV, float HD, int PSclass, int Soilclass,
+		float stlat, float stlon) {
+	float envelopes[4] = { ZV, HA, HV, HD };
+	StationTerms terms;
+	terms.PSclass = PSclass;
+	terms.Soilclass = Soilclass;
+	terms.gmr = VsEquations::ground_motion_ratio(ZA, ZD);
+	terms.edistalt = VsEquations::edistalt(stlat, stlon);
+	for ( int kk = 0; kk < 4; kk++ )
+		terms.logenvelopes[kk] = log10(envelopes[kk]);
+	return terms;
+}
+
+/*!
+ \brief Searches the magnitude between 0.5 and 9.0 with the smallest sum of
+ the station likelihoods.
+
+ The result is identical to calling likelihood() for every magnitude and
+ station but all magnitude independent terms are computed only once and
+ the magnitude dependent ones are taken from a precomputed table. The
+ likelihoods are accumulated over the stations in the given order for all
+ magnitudes at once.
+ \param minL Returns the smallest sum of likelihoods
+ \return The magnitude of the smallest sum of likelihoods
+ */
+float VsEquations::gridsearch(const std::vector<StationTerms> &stations,
+		float &minL) {
+	const MagnitudeGrid &grid = magnitudeGrid();
+	const size_t n = grid.mags.size();
+	int wavetypes[4] = { zv, ha, hv, hd };
+	std::vector<float> L(n, 0.0f);
+
+	for ( size_t i = 0; i < stations.size(); ++i ) {
+		const StationTerms &st = stations[i];
+		const float *zavg = &grid.zavg[st.PSclass][0];
+		float sigma_zad = VsEquations::zavgerr(st.PSclass);
+		float a[4], b[4], d[4], e[4], sigma[4];
+		const float *sat[4];
+
+		for ( int kk = 0; kk < 4; kk++ ) {
+			a[kk] = VsEquations::geta(st.PSclass, wavetypes[kk], st.Soilclass);
+			b[kk] = VsEquations::getb(st.PSclass, wavetypes[kk], st.Soilclass);
+			d[kk] = VsEquations::getd(st.PSclass, wavetypes[kk], st.Soilclass);
+			e[kk] = VsEquations::gete(st.PSclass, wavetypes[kk], st.Soilclass);
+			sigma[kk] = VsEquations::getsigma(st.PSclass, wavetypes[kk], st.Soilclass);
+			sat[kk] = &grid.saturation[st.PSclass][wavetypes[kk]][st.Soilclass][0];
+		}
+
+		for ( size_t m = 0; m < n; ++m ) {
+			float mag = grid.mags[m];
+			float l1 = pow(st.gmr - zavg[m], 2) / (2 * pow(sigma_zad, 2));
+			float l2 = 0;
+			for ( int kk = 0; kk < 4; kk++ ) {
+				// Same as amplitude()
+				float f0 = st.edistalt + sat[kk][m];
+				float f1 = a[kk] * mag;
+				float f2 = b[kk] * f0;
+				float f3 = d[kk] * log10(f0);
+				float f4 = e[kk];
+				float amp = f1 + f2 + f3 + f4;
+				float l3 = pow(((LogType)st.logenvelopes[kk] - amp), 2) /
+						(2 * pow(sigma[kk], 2));
+				l2 += l3;
+			}
+			L[m] += l1 + l2;
+		}
+	}
+
+	float minMag = grid.mags[0];
+	minL = -1.0f;
+	for ( size_t m = 0; m < n; ++m ) {
+		if ( minL < 0 || minL > L[m] ) {
+			minL = L[m];
+			minMag = grid.mags[m];
+		}
+	}
+
+	return minMag;
+}
+
 void VsEquations::setmag(float magnitude) {
 	mag = magnitude;
 }
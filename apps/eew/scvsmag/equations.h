@@ -17,7 +17,24 @@
 #ifndef VSEQUATIONS_H_
 #define VSEQUATIONS_H_
 
+#include <vector>
+
 class VsEquations {
+public:
+	/*!
+	 Magnitude independent terms of the likelihood of one station. They
+	 are computed once with stationterms() and reused for every magnitude
+	 of the grid search.
+	 */
+	struct StationTerms {
+		int PSclass;
+		int Soilclass;
+		float gmr;
+		float edistalt;
+		// log10 of ZV, HA, HV and HD
+		double logenvelopes[4];
+	};
+
 private:
 	float mag, eqlat, eqlon, norm;
 	// HA, HV, HD, ZA, ZV, ZD
@@ -46,6 +63,9 @@ public:
 			const float stlon);
 	float likelihood(float ZA, float ZV, float ZD, float HA, float HV, float HD,
 			int PSclass, int Soilclass, float stlat, float stlon);
+	StationTerms stationterms(float ZA, float ZV, float ZD, float HA, float HV,
+			float HD, int PSclass, int Soilclass, float stlat, float stlon);
+	float gridsearch(const std::vector<StationTerms> &stations, float &minL);
 	// getters and setters
 	const float geteqlat();
 	void seteqlat(float eventlat);
@@ -24,12 +24,6 @@ using namespace Seiscomp::DataModel;
 using namespace Seiscomp::Math;
 using namespace Seiscomp::Processing;
 
-namespace {
-
-VsEquations vs;
-
-}
-
 /*!
  \brief set up messaging and some default values at startup
  */
@@ -77,6 +71,8 @@ VsMagnitude::VsMagnitude(int argc, char **argv) :
 	_timeout = 3600.;
 	// default vs30 value
 	_vs30default = 910.0;
+	// by default take the Vs30 value of the nearest grid point
+	_vs30interpolation = false;
 
 	// by default don't use site effects
 	_siteEffect = false;
@@ -86,9 +82,18 @@ VsMagnitude::VsMagnitude(int argc, char **argv) :
 
 	// maximum epicentral distance; -1 means no restriction
 	_maxepicdist = -1.0f;
+
+	// by default process all events in the main thread
+	_threads = 1;
+
+	// by default do not report statistics
+	_statsInterval = 0;
+	_statisticsChannel = NULL;
+	_statisticsFile = NULL;
 }
 
 VsMagnitude::~VsMagnitude() {
+	_log.stop();
 }
 
 /*!
@@ -106,6 +111,10 @@ void VsMagnitude::createCommandLineDescription() {
 	commandline().addOption("Log", "processing-log",
 			"Set an alternative filename for the processing log-file.", &_proclogfile);
 	commandline().addOption("Log", "envelope-log", "Turn on envelope logging.");
+	commandline().addGroup("Vs30");
+	commandline().addOption("Vs30", "convert-vs30",
+			"Convert the Vs30 grid file configured with vsmag.vs30filename into a binary raster file with the given name and exit.",
+			&_vs30raster);
 }
 
 /*!
@@ -127,8 +136,10 @@ bool VsMagnitude::initConfiguration() {
 				"vsmag.siteEffect not given, using default of %s", Core::toString(_siteEffect).c_str());
 	}
 
-	// read the filename of a Vs30 value grid file for site effect correction
-	if ( _siteEffect ) {
+	// read the filename of a Vs30 value grid file for site effect correction,
+	// the file is also required for converting it independent of the site
+	// effect correction
+	if ( _siteEffect || commandline().hasOption("convert-vs30") ) {
 		try {
 			_vs30filename = configGetString("vsmag.vs30filename");
 		} catch ( ... ) {
@@ -233,6 +244,13 @@ bool VsMagnitude::initConfiguration() {
 			SEISCOMP_INFO(
 					"vsmag.vs30default not configured, using default: %f", _vs30default);
 		}
+
+		try {
+			_vs30interpolation = configGetBool("vsmag.vs30interpolation");
+		} catch ( ... ) {
+			SEISCOMP_INFO(
+					"vsmag.vs30interpolation not configured, using default: %s", _vs30interpolation ? "true" : "false");
+		}
 	}
 
 	// Set a maximum epicentral distance past which stations will not contribute
@@ -260,6 +278,33 @@ bool VsMagnitude::initConfiguration() {
 		SEISCOMP_INFO("Logging envelopes is turned off.");
 	}
 
+	// number of events that are processed concurrently
+	try {
+		_threads = configGetInt("vsmag.threads");
+		if ( _threads < 1 ) {
+			SEISCOMP_ERROR(
+					"vsmag.threads must be at least 1 (%d < 1)", _threads);
+			return false;
+		}
+	} catch ( ... ) {
+		SEISCOMP_INFO(
+				"vsmag.threads not configured, using default: %d", _threads);
+	}
+
+	// Interval in seconds in which statistics are written to the
+	// statistics log
+	try {
+		_statsInterval = configGetInt("vsmag.statsInterval");
+		if ( _statsInterval < 0 ) {
+			SEISCOMP_ERROR(
+					"vsmag.statsInterval must not be negative (%d < 0)", _statsInterval);
+			return false;
+		}
+	} catch ( ... ) {
+		SEISCOMP_INFO(
+				"vsmag.statsInterval not configured, using default: %d", _statsInterval);
+	}
+
 	return true;
 }
 
@@ -274,6 +319,13 @@ bool VsMagnitude::validateParameters() {
 	if ( commandline().hasOption("envelope-log") )
 		 _logenvelopes = true;
 
+	// Converting the Vs30 file does not need any connection
+	if ( commandline().hasOption("convert-vs30") ) {
+		setMessagingEnabled(false);
+		setDatabaseEnabled(false, false);
+		setLoadInventoryEnabled(false);
+	}
+
 	return Application::validateParameters();
 }
 
@@ -284,6 +336,9 @@ bool VsMagnitude::init() {
 	if ( !Client::Application::init() )
 		return false;
 
+	if ( commandline().hasOption("convert-vs30") )
+		return true;
+
 	enableTimer(1);
 
 	Client::Inventory *inv = Client::Inventory::Instance();
@@ -300,11 +355,18 @@ bool VsMagnitude::init() {
 					"no Vs30 file name specified, turning off siteEffect");
 			_siteEffect = false;
 		} else {
-			if ( !ch::sed::Vs30Mapping::createInstance(_vs30filename) ) {
+			ch::sed::Vs30Mapping *vsmappingP =
+					ch::sed::Vs30Mapping::createInstance(_vs30filename);
+			if ( !vsmappingP ) {
 				SEISCOMP_ERROR(
 						"Error reading Vs30 file %s, turning siteEffect off", _vs30filename.c_str());
 				_siteEffect = false;
 			}
+			else {
+				vsmappingP->setVsDefault(ch::sed::Vs30Mapping::TYPE_VS30,
+						_vs30default);
+				vsmappingP->setBilinear(_vs30interpolation);
+			}
 		}
 	}
 	if ( !_siteEffect ) {
@@ -325,6 +387,12 @@ bool VsMagnitude::init() {
 	// initialize the circular buffer
 	_timeline.init(_backSlots, _headSlots, _clipTimeout);
 
+	// Events are processed concurrently if more than one thread is
+	// configured
+	_workers.start(_threads);
+	if ( _threads > 1 )
+		SEISCOMP_INFO("processing up to %d events concurrently", _threads);
+
 	if ( _realtime ) {
 		_currentTime = Core::Time::GMT();
 		_timeline.setReferenceTime(_currentTime);
@@ -349,8 +417,12 @@ bool VsMagnitude::init() {
 	_processingInfoFile->subscribe(_processingInfoChannel);
 	_processingInfoOutput = new Logging::FdOutput(STDERR_FILENO);
 	_processingInfoOutput->subscribe(_processingInfoChannel);
-	SEISCOMP_LOG(_processingInfoChannel,
-			"scvsmag module started at %s", Core::Time::GMT().toString("%FT%T.%fZ").c_str());
+
+	// Processing and envelope logs are written by a background thread
+	_log.start();
+
+	_log.post(_processingInfoChannel,
+			"scvsmag module started at " + Core::Time::GMT().toString("%FT%T.%fZ"));
 
 	if ( _logenvelopes ){
 		_envelopeInfoChannel =
@@ -360,9 +432,60 @@ bool VsMagnitude::init() {
 				60 * 60 * 24, 30);
 		_envelopeInfoFile->subscribe(_envelopeInfoChannel);
 	}
+
+	if ( _statsInterval > 0 ) {
+		_statisticsChannel =
+				SEISCOMP_DEF_LOGCHANNEL("statistics/info", Logging::LL_INFO);
+		_statisticsFile = new Logging::FileRotatorOutput(
+				Environment::Instance()->logFile(appname+"-statistics").c_str(),
+				60 * 60 * 24, 30);
+		_statisticsFile->subscribe(_statisticsChannel);
+		_lastStatisticsTime = Core::Time::GMT();
+	}
 	return true;
 }
 
+/*!
+ Runs the message loop or only converts the Vs30 file if requested.
+ */
+bool VsMagnitude::run() {
+	if ( commandline().hasOption("convert-vs30") ) {
+		if ( _vs30filename.empty() ) {
+			SEISCOMP_ERROR("vsmag.vs30filename not given, nothing to convert");
+			return false;
+		}
+		return ch::sed::Vs30Mapping::convert(_vs30filename, _vs30raster);
+	}
+
+	return Client::Application::run();
+}
+
+/*!
+ \brief Look up the Vs30 value of a site in the site cache
+ */
+bool VsMagnitude::siteVs30(double lat, double lon, float &vs30) {
+	std::lock_guard<std::mutex> lock(_siteMutex);
+
+	Site &site = _sites[std::make_pair(lat, lon)];
+	if ( !site.initialized ) {
+		site.initialized = true;
+		try {
+			ch::sed::Vs30Mapping * vsmappingP =
+					ch::sed::Vs30Mapping::sharedInstance();
+			site.vs30 = vsmappingP->getVs(ch::sed::Vs30Mapping::TYPE_VS30,
+					lat, lon);
+			site.valid = true;
+		} catch ( ... ) {
+			SEISCOMP_ERROR(
+					"Failed to get VS30 value for lat: %.2f; lon: %.2f", lat, lon);
+			site.valid = false;
+		}
+	}
+
+	vs30 = site.vs30;
+	return site.valid;
+}
+
 /*!\brief Compute site amplification factors
 
  Compute site amplification factors by combining Vs30 values with the
@@ -376,28 +499,15 @@ bool VsMagnitude::init() {
 float VsMagnitude::siteEffect(double lat, double lon, double MA,
 		ValueType valueType, SoilClass &soilClass) {
 	float corr;
-	if ( _siteEffect ) {
-		try {
-			float _vs30;
-			ch::sed::Vs30Mapping * vsmappingP =
-					ch::sed::Vs30Mapping::sharedInstance();
-			vsmappingP->setVsDefault(ch::sed::Vs30Mapping::TYPE_VS30,
-					_vs30default);
-			_vs30 = vsmappingP->getVs(ch::sed::Vs30Mapping::TYPE_VS30, lat,
-					lon);
-			corr = _saflist.getCorr(valueType, _vs30, MA);
-			if ( _vs30 > 464 ) {
-				soilClass = Rock;
-			} else if ( _vs30 <= 464 && _vs30 > 0. ) {
-				soilClass = Soil;
-			} else {
-				SEISCOMP_ERROR("Vs30 value can't be negative.");
-			}
-		} catch ( ... ) {
-			SEISCOMP_ERROR(
-					"Failed to get VS30 value for lat: %.2f; lon: %.2f", lat, lon);
-			corr = 1.0;
+	float _vs30;
+	if ( _siteEffect && siteVs30(lat, lon, _vs30) ) {
+		corr = _saflist.getCorr(valueType, _vs30, MA);
+		if ( _vs30 > 464 ) {
 			soilClass = Rock;
+		} else if ( _vs30 <= 464 && _vs30 > 0. ) {
+			soilClass = Soil;
+		} else {
+			SEISCOMP_ERROR("Vs30 value can't be negative.");
 		}
 	} else {
 		corr = 1.0;
@@ -406,6 +516,40 @@ float VsMagnitude::siteEffect(double lat, double lon, double MA,
 	return corr;
 }
 
+namespace {
+
+//! The values of an envelope channel for the envelope log
+struct EnvelopeRecord {
+	Core::Time currentTime;
+	Core::Time timestamp;
+	string networkCode;
+	string stationCode;
+	string channelCode;
+	vector<pair<string, double> > values;
+
+	string toString() const {
+		string str = "Current time: ";
+		str += currentTime.toString("%FT%T.%3fZ");
+		str += "; Envelope: timestamp: ";
+		str += timestamp.toString("%FT%T.%3fZ");
+		str += " waveformID: ";
+		str += networkCode;
+		str += ".";
+		str += stationCode;
+		str += ".";
+		str += channelCode;
+		for ( size_t i = 0; i < values.size(); ++i ) {
+			str += " ";
+			str += values[i].first;
+			str += ": ";
+			str += Core::toString(values[i].second);
+		}
+		return str;
+	}
+};
+
+}
+
 /*!
  * Handle incoming messages from scmaster.
  */
@@ -423,7 +567,11 @@ void VsMagnitude::handleMessage(Core::Message* msg) {
 	for ( DataMessage::iterator it = dm->begin(); it != dm->end(); ++it ) {
 		VS::Envelope *vsenv = VS::Envelope::Cast(it->get());
 		if ( vsenv ) {
-			string str;
+			if ( _statsInterval > 0 ) {
+				++_statistics.envelopes;
+				_statistics.envelopeAge.add(
+						(double) (Core::Time::GMT() - vsenv->timestamp()));
+			}
 
 			if ( !_realtime ) {
 				if ( !_currentTime.valid()
@@ -434,36 +582,45 @@ void VsMagnitude::handleMessage(Core::Message* msg) {
 				}
 			}
 
-			for ( size_t eit = 0; eit < vsenv->envelopeChannelCount(); ++eit ) {
-				VS::EnvelopeChannel *chan = vsenv->envelopeChannel(eit);
-				const DataModel::WaveformStreamID &wid = chan->waveformID();
-
-				str = "Current time: ";
-				str += _currentTime.toString("%FT%T.%3fZ");
-				str += "; Envelope: timestamp: ";
-				str += vsenv->timestamp().toString("%FT%T.%3fZ");
-				str += " waveformID: ";
-				str += wid.networkCode();
-				str += ".";
-				str += wid.stationCode();
-				str += ".";
-				str += wid.channelCode();
-				for ( size_t cit = 0; cit < chan->envelopeValueCount();
-						++cit ) {
-					VS::EnvelopeValue *eval = chan->envelopeValue(cit);
-					str += " ";
-					str += eval->type();
-					str += ": ";
-					str += Core::toString(eval->value());
+			// Only the values are copied here, the log lines are formatted
+			// in the background
+			if ( _logenvelopes ) {
+				for ( size_t eit = 0; eit < vsenv->envelopeChannelCount(); ++eit ) {
+					VS::EnvelopeChannel *chan = vsenv->envelopeChannel(eit);
+					const DataModel::WaveformStreamID &wid = chan->waveformID();
+
+					EnvelopeRecord rec;
+					rec.currentTime = _currentTime;
+					rec.timestamp = vsenv->timestamp();
+					rec.networkCode = wid.networkCode();
+					rec.stationCode = wid.stationCode();
+					rec.channelCode = wid.channelCode();
+					for ( size_t cit = 0; cit < chan->envelopeValueCount();
+							++cit ) {
+						VS::EnvelopeValue *eval = chan->envelopeValue(cit);
+						rec.values.push_back(make_pair(eval->type(), eval->value()));
+					}
+
+					_log.post(_envelopeInfoChannel, [rec] { return rec.toString(); });
 				}
 			}
-			if (_logenvelopes)
-				SEISCOMP_LOG(_envelopeInfoChannel, "%s", str.c_str());
 
 			if ( !_timeline.feed(vsenv) ) {
 				SEISCOMP_WARNING("ignored incoming envelope");
+				++_statistics.ignoredEnvelopes;
 				dirty = false;
 			}
+
+			// Remember the time span of received envelopes per station to
+			// recompute only the affected stations of the events
+			Timeline::StationID id(vsenv->network(), vsenv->station());
+			StationUpdates::iterator uit = _updates.find(id);
+			if ( uit == _updates.end() )
+				_updates[id] = Core::TimeWindow(vsenv->timestamp(), vsenv->timestamp());
+			else if ( vsenv->timestamp() < uit->second.startTime() )
+				uit->second.setStartTime(vsenv->timestamp());
+			else if ( vsenv->timestamp() > uit->second.endTime() )
+				uit->second.setEndTime(vsenv->timestamp());
 		}
 	}
 
@@ -481,6 +638,54 @@ void VsMagnitude::handleTimeout() {
 		_timeline.setReferenceTime(_currentTime);
 		processEvents();
 	}
+
+	if ( _statsInterval > 0
+			&& Core::Time::GMT() - _lastStatisticsTime >= Core::TimeSpan(_statsInterval, 0) )
+		reportStatistics();
+}
+
+/*!
+ \brief Write the statistics of the last interval to the statistics log
+ */
+void VsMagnitude::reportStatistics() {
+	Core::Time now = Core::Time::GMT();
+	const Timeline::Statistics &timeline = _timeline.statistics();
+	Statistics &stats = _statistics;
+
+	ostringstream out;
+	out << "interval: " << (double) (now - _lastStatisticsTime) << " s";
+	out << "; envelopes: " << stats.envelopes;
+	out << "; ignored envelopes: " << stats.ignoredEnvelopes;
+	out << "; dropped channels: too old: "
+	    << timeline.tooOld - stats.timeline.tooOld;
+	out << ", too far in the future: "
+	    << timeline.tooNew - stats.timeline.tooNew;
+	out << ", unknown stream: "
+	    << timeline.unknownStream - stats.timeline.unknownStream;
+	out << ", unknown channel: "
+	    << timeline.unknownChannel - stats.timeline.unknownChannel;
+	_log.post(_statisticsChannel, out.str());
+
+	out.str("");
+	out << "reference time lag: ";
+	if ( _timeline.referenceTime().valid() )
+		out << (double) (now - _timeline.referenceTime()) << " s";
+	else
+		out << "unset";
+	out << "; events: " << _events.size();
+	_log.post(_statisticsChannel, out.str());
+
+	_log.post(_statisticsChannel, "envelope age: " + stats.envelopeAge.toString());
+	_log.post(_statisticsChannel, "event processing time: " + stats.processingTime.toString());
+	_log.post(_statisticsChannel, "grid search time: " + stats.gridSearchTime.toString());
+
+	stats.envelopes = 0;
+	stats.ignoredEnvelopes = 0;
+	stats.envelopeAge.reset();
+	stats.processingTime.reset();
+	stats.gridSearchTime.reset();
+	stats.timeline = timeline;
+	_lastStatisticsTime = now;
 }
 
 /*!
@@ -536,6 +741,44 @@ void VsMagnitude::removeObject(const std::string &parentID,
  ************************************************************************/
 void VsMagnitude::handlePick(Pick *pk) {
 	_cache.feed(pk);
+	indexPick(pk);
+}
+
+/*!
+ \brief Add a pick to the pick index
+
+ Picks are removed from the index after the same time span as objects
+ are kept in the cache.
+ */
+void VsMagnitude::indexPick(const Pick *pk) {
+	PickInfo info;
+	info.station = Timeline::StationID(pk->waveformID().networkCode(),
+			pk->waveformID().stationCode());
+	info.time = pk->time().value();
+
+	if ( _picks.insert(PickIndex::value_type(pk->publicID(), info)).second )
+		_pickOrder.push_back(make_pair(info.time, pk->publicID()));
+
+	Core::Time limit = info.time - Core::TimeSpan(_timeout, 0);
+	while ( !_pickOrder.empty() && _pickOrder.front().first < limit ) {
+		_picks.erase(_pickOrder.front().second);
+		_pickOrder.pop_front();
+	}
+}
+
+/*!
+ \brief Fetch all picks of an origin from the database with one query
+ */
+void VsMagnitude::fetchPicks(const Origin *org) {
+	DatabaseIterator it = query()->getPicks(org->publicID());
+	for ( ; *it; ++it ) {
+		Pick *pk = Pick::Cast(*it);
+		if ( pk ) {
+			_cache.feed(pk);
+			indexPick(pk);
+		}
+	}
+	it.close();
 }
 
 /*!
@@ -606,6 +849,10 @@ void VsMagnitude::handleEvent(Event *event) {
 	else
 		vsevent = it->second;
 
+	/// Results of the previous preferred origin cannot be reused
+	vsevent->cache.clear();
+	vsevent->gridValid = false;
+
 	/// Populate the vsevent with data from the preferred origin of the sc3 event
 	vsevent->lat = org->latitude().value();
 	vsevent->lon = org->longitude().value();
@@ -621,24 +868,35 @@ void VsMagnitude::handleEvent(Event *event) {
 		return;
 	}
 
+	/// Look up the picks of all arrivals. Picks that have not been received
+	/// are fetched from the database with a single query.
+	bool missing = false;
+	for ( size_t i = 0; i < org->arrivalCount() && !missing; ++i )
+		missing = _picks.find(org->arrival(i)->pickID()) == _picks.end();
+
+	if ( missing && isDatabaseEnabled() && query() )
+		fetchPicks(org.get());
+
 	/// Generate some statistics for later use in delta-pick quality measure
 	Timeline::StationList pickedThresholdStations; // all picked stations at a limited distance from the epicenter
+	vector<pair<const PickInfo*, double> > pickDistances;
 	vsevent->pickedStations.clear();
 	SEISCOMP_DEBUG("Number of arrivals in origin %s: %d", org->publicID().c_str(), (int)org->arrivalCount());
 	vsevent->stations.clear();
 	for ( size_t i = 0; i < org->arrivalCount(); ++i ) {
 		Arrival *arr = org->arrival(i);
-		PickPtr pick = _cache.get<Pick>(arr->pickID());
-		if ( !pick ) {
-			SEISCOMP_DEBUG("cache.get<Pick>(\"%s\") failed to return pick", arr->pickID().c_str());
+		PickIndex::const_iterator pit = _picks.find(arr->pickID());
+		if ( pit == _picks.end() ) {
+			SEISCOMP_DEBUG("pick %s not found", arr->pickID().c_str());
 			continue;
 		}
-		Timeline::StationID id(pick->waveformID().networkCode(),
-				pick->waveformID().stationCode());
+		const PickInfo *pick = &pit->second;
+		const Timeline::StationID &id = pick->station;
+		double dist = arr->distance();
+		pickDistances.push_back(make_pair(pick, dist));
 
 		// if the station is not yet in the pickedStations set
 		if ( vsevent->pickedStations.find(id) == vsevent->pickedStations.end() ) {
-			double dist = arr->distance();
 			if ( dist > dmax )
 				dmax = dist;
 			vsevent->pickedStations.insert(id);
@@ -650,9 +908,9 @@ void VsMagnitude::handleEvent(Event *event) {
 			continue;
 
 		VsTimeWindow &tw = vsevent->stations[id];
-		tw.setStartTime(pick->time().value() - Core::TimeSpan(_twstarttime, 0));
-		tw.setEndTime(pick->time().value() + Core::TimeSpan(_twendtime, 0));
-		tw.setPickTime(pick->time().value());
+		tw.setStartTime(pick->time - Core::TimeSpan(_twstarttime, 0));
+		tw.setEndTime(pick->time + Core::TimeSpan(_twendtime, 0));
+		tw.setPickTime(pick->time);
 		// Todo: make sure that at least three seconds of data after the pick
 		// are available
 	}
@@ -663,18 +921,9 @@ void VsMagnitude::handleEvent(Event *event) {
 	davg = dsum / (double) vsevent->pickedStationsCount;
 	// calculate threshold
 	dthresh = 0.5 * (dmax + davg);
-	for ( size_t i = 0; i < org->arrivalCount(); i++ ) {
-		Arrival *arr = org->arrival(i);
-		PickPtr pick = _cache.get<Pick>(arr->pickID());
-		if ( !pick ) {
-			SEISCOMP_DEBUG("cache.get<Pick>(\"%s\") failed to return pick", arr->pickID().c_str());
-			continue;
-		}
-		Timeline::StationID id(pick->waveformID().networkCode(),
-				pick->waveformID().stationCode());
-		if ( pick && arr->distance() < dthresh ) { // if the
-			pickedThresholdStations.insert(id);
-		}
+	for ( size_t i = 0; i < pickDistances.size(); ++i ) {
+		if ( pickDistances[i].second < dthresh )
+			pickedThresholdStations.insert(pickDistances[i].first->station);
 	}
 
 	vsevent->pickedThresholdStationsCount = pickedThresholdStations.size();
@@ -694,271 +943,435 @@ void VsMagnitude::handleEvent(Event *event) {
 
 namespace {
 
-/*!
- Input structure for final VS magnitude computation.
- This should also hold all values that are not dependent on the input
- magnitude of the grid search. The grid search should use those values to
- not compute values redundantly. And at the end these values (e.g. station
- magnitude) should be used to compute the RMS of the final magnitude.
- */
-struct VsInput {
-	float ZA, ZV, ZD, HA, HV, HD;
-	WaveType PSclass;
-	SoilClass SOILclass;
-	float lat, lon;
-	float mest;
-};
+bool equal(float a, float b) {
+	return a == b || (Math::isNaN(a) && Math::isNaN(b));
+}
+
+}
 
+bool VsMagnitude::VsInput::sameAs(const VsInput &other) const {
+	return equal(ZA, other.ZA) && equal(ZV, other.ZV) && equal(ZD, other.ZD)
+	    && equal(HA, other.HA) && equal(HV, other.HV) && equal(HD, other.HD)
+	    && PSclass == other.PSclass && SOILclass == other.SOILclass
+	    && equal(lat, other.lat) && equal(lon, other.lon)
+	    && equal(mest, other.mest);
 }
 
 /*!
  \brief Process all events in the cache
+
+ The events are processed concurrently if vsmag.threads is larger than one.
+ Looking up the events in the cache and publishing the results is always
+ done in the main thread in the order of the events.
  */
 void VsMagnitude::processEvents() {
 	_lastProcessingTime = _currentTime;
+
+	struct Job {
+		VsEvents::iterator it;
+		EventPtr event;
+		OriginPtr org;
+		VsResult result;
+	};
+
+	vector<Job> jobs;
+	jobs.reserve(_events.size());
+
 	VsEvents::iterator it;
-	for ( it = _events.begin(); it != _events.end(); ) {
-		VsEvent *evt = it->second.get();
+	for ( it = _events.begin(); it != _events.end(); ++it ) {
 		EventPtr event = _cache.get<Event>(it->first);
-		if ( event != NULL ) {
-			if ( _currentTime < evt->expirationTime ) {
-				process(evt, event.get());
-				// only send the message / update the database if the event has a VS magnitude
-				if ( evt->vsMagnitude ) {
-					evt->update++;
-					updateVSMagnitude(event.get(), evt);
-				}
-			} else {
-				process(evt, event.get());
-				// only send the message / update the database if the event has a VS magnitude
-				if ( evt->vsMagnitude )
-					updateVSMagnitude(event.get(), evt);
-				_events.erase(it++);
-				_publishedEvents[event->publicID()] = _currentTime;
-				SEISCOMP_LOG(_processingInfoChannel,
-						"Processing of event %s is finished.", event->publicID().c_str());
-				// erase outdated events
-				EventIDBuffer::iterator cev;
-				for ( cev = _publishedEvents.begin();
-						cev != _publishedEvents.end(); ) {
-					if ( cev->second
-							< (_currentTime - Core::TimeSpan(_timeout, 0)) ) {
-						_publishedEvents.erase(cev++);
-						continue;
-					}
-					++cev;
+		if ( event == NULL ) {
+			SEISCOMP_WARNING("%s: event not found", it->first.c_str());
+			// Envelope updates are not tracked beyond this run
+			it->second->cache.clear();
+			it->second->gridValid = false;
+			continue;
+		}
+
+		jobs.resize(jobs.size() + 1);
+		Job &job = jobs.back();
+		job.it = it;
+		job.event = event;
+		job.org = _cache.get<Origin>(event->preferredOriginID());
+	}
+
+	_workers.run(jobs.size(), [this, &jobs](size_t i) {
+		Job &job = jobs[i];
+		Core::Time start = Core::Time::GMT();
+		job.result.gridSearchTime = -1;
+		process(job.it->second.get(), job.event.get(), job.org.get(),
+		        job.result);
+		job.result.processingTime = (double) (Core::Time::GMT() - start);
+	});
+
+	for ( size_t i = 0; i < jobs.size(); ++i ) {
+		Job &job = jobs[i];
+		VsEvent *evt = job.it->second.get();
+		Event *event = job.event.get();
+
+		publish(evt, job.org.get(), job.result);
+
+		if ( _statsInterval > 0 ) {
+			_statistics.processingTime.add(job.result.processingTime);
+			if ( job.result.gridSearchTime >= 0 )
+				_statistics.gridSearchTime.add(job.result.gridSearchTime);
+		}
+
+		if ( _currentTime < evt->expirationTime ) {
+			// only send the message / update the database if the event has a VS magnitude
+			if ( evt->vsMagnitude ) {
+				evt->update++;
+				updateVSMagnitude(event, evt);
+			}
+		} else {
+			// only send the message / update the database if the event has a VS magnitude
+			if ( evt->vsMagnitude )
+				updateVSMagnitude(event, evt);
+			_events.erase(job.it);
+			_publishedEvents[event->publicID()] = _currentTime;
+			_log.post(_processingInfoChannel,
+					"Processing of event " + event->publicID() + " is finished.");
+			// erase outdated events
+			EventIDBuffer::iterator cev;
+			for ( cev = _publishedEvents.begin();
+					cev != _publishedEvents.end(); ) {
+				if ( cev->second
+						< (_currentTime - Core::TimeSpan(_timeout, 0)) ) {
+					_publishedEvents.erase(cev++);
+					continue;
 				}
+				++cev;
+			}
+		}
+	}
+
+	_updates.clear();
+}
+
+/*!
+ \brief Publish the results of process()
+
+ Creates the station magnitudes in the preferred origin and writes the
+ processing log. Station magnitudes that did not change since the last
+ update are not created again but referenced by the new magnitude. This
+ must be called from the main thread.
+ */
+void VsMagnitude::publish(VsEvent *evt, Origin *org, const VsResult &result) {
+	if ( org ) {
+		evt->staMags.clear();
+
+		// Record single station magnitudes
+		Notifier::SetEnabled(true);
+		for ( size_t i = 0; i < result.staMags.size(); ++i ) {
+			VsStation &station = evt->cache[result.staMags[i].station];
+			if ( !result.staMags[i].changed && station.staMag ) {
+				evt->staMags.push_back(station.staMag);
 				continue;
 			}
-		} else
-			SEISCOMP_WARNING("%s: event not found", it->first.c_str());
-		++it;
+
+			_creationInfo.setCreationTime(Core::Time::GMT()); // was "_currentTime);" before but didn't allow sub-second precision.
+			_creationInfo.setModificationTime(Core::None);
+			DataModel::StationMagnitudePtr staMag = DataModel::StationMagnitude::Create();
+			staMag->setMagnitude(RealQuantity(result.staMags[i].magnitude));
+			staMag->setType("MVS");
+			staMag->setCreationInfo(_creationInfo);
+			staMag->setWaveformID(result.staMags[i].waveformID);
+			org->add(staMag.get());
+			evt->staMags.push_back(staMag);
+			station.staMag = staMag;
+		}
+		Notifier::SetEnabled(false);
+	}
+
+	for ( size_t i = 0; i < result.log.size(); ++i )
+		_log.post(_processingInfoChannel, result.log[i]);
+}
+
+/*!
+ \brief Check whether the cached result of a station is still valid
+
+ The result is valid if it was computed from a time window that was
+ completely inside the timeline, the window is still inside the timeline and
+ no envelopes for the station have been received within the window
+ (including the clip timeout before it) since.
+ */
+bool VsMagnitude::isCached(const VsStation &station,
+		const Timeline::StationID &id, const VsTimeWindow &tw) const {
+	if ( !station.valid || !station.complete )
+		return false;
+
+	Core::Time start = tw.startTime() - Core::TimeSpan(_clipTimeout, 0);
+	Core::Time end = tw.endTime();
+	if ( !_timeline.covers(start, end) )
+		return false;
+
+	if ( station.sensors != _timeline.sensorCount(id) )
+		return false;
+
+	StationUpdates::const_iterator it = _updates.find(id);
+	if ( it == _updates.end() )
+		return true;
+
+	// Envelopes are stored in slots of one second
+	Core::TimeSpan margin(1, 0);
+	return it->second.endTime() + margin < start
+	    || it->second.startTime() - margin > end;
+}
+
+/*!
+ \brief Compute the station magnitude of one station of an event
+
+ The results are stored in station which is kept in the cache of the event.
+ */
+void VsMagnitude::processStation(const VsEvent *evt,
+		const Timeline::StationID &id, const VsTimeWindow &tw,
+		VsStation &station) {
+	Client::Inventory *inv = Client::Inventory::Instance();
+	VsEquations vs;
+	Envelope venv, henv;
+	Core::Time vtime, htime;
+	string locationCode, channelCode;
+	double distdg, epicdist, azi1, azi2;
+	ReturnCode ret;
+
+	station.valid = true;
+	station.complete = _timeline.covers(
+			tw.startTime() - Core::TimeSpan(_clipTimeout, 0), tw.endTime());
+	station.sensors = _timeline.sensorCount(id);
+	station.unused = false;
+	station.hasInput = false;
+	station.log.clear();
+
+	vs.seteqlat(evt->lat);
+	vs.seteqlon(evt->lon);
+
+	ret = _timeline.maxmimum(id, tw.startTime(), tw.endTime(), tw.pickTime(),
+			venv, vtime, henv, htime, locationCode, channelCode);
+
+	if ( no_data == ret ){
+		SEISCOMP_WARNING("No data available for %s.%s.%s", id.first.c_str(),
+				id.second.c_str(),locationCode.c_str());
+		station.unused = true;
+		return;
+	}
+
+	DataModel::SensorLocation *loc;
+	loc = inv->getSensorLocation(id.first, id.second, locationCode,
+			tw.pickTime());
+	if ( loc == NULL ) {
+		SEISCOMP_WARNING(
+				"%s.%s.%s: sensor location not in inventory: ignoring", id.first.c_str(), id.second.c_str(), locationCode.c_str());
+		return;
+	}
+
+	Math::Geo::delazi(evt->lat, evt->lon, loc->latitude(), loc->longitude(),
+			&distdg, &azi1, &azi2);
+	epicdist = Math::Geo::deg2km(distdg);
+
+	// if data is clipped or not enough to use it for magnitude
+	// computation add the station to the overall count and then continue
+	if ( not_enough_data == ret || clipped_data == ret){
+		SEISCOMP_WARNING("Not enough data available for %s.%s.%s", id.first.c_str(),
+				id.second.c_str(),locationCode.c_str());
+		station.unused = true;
+		return;
 	}
+
+	// catch remaining errors
+	if ( index_error == ret || undefined_problem == ret)
+		return;
+
+	if ( _maxepicdist > 0 ){
+		if( epicdist > _maxepicdist )
+			return;
+	}
+
+	station.hasInput = true;
+	VsInput &input = station.input;
+	input.lat = (float) loc->latitude();
+	input.lon = (float) loc->longitude();
+
+	SoilClass soilClass;
+	float ca = siteEffect(input.lat, input.lon,
+			std::max(venv.values[Acceleration], henv.values[Acceleration]),
+			Acceleration, soilClass);
+	float cv = siteEffect(input.lat, input.lon,
+			std::max(venv.values[Velocity], henv.values[Velocity]),
+			Velocity, soilClass);
+	float cd = siteEffect(input.lat, input.lon,
+			std::max(venv.values[Displacement], henv.values[Displacement]),
+			Displacement, soilClass);
+
+	// Convert from m to cm and apply site effect correction
+	input.ZA = (float) (venv.values[Acceleration] / ca) * 100;
+	input.ZV = (float) (venv.values[Velocity] / cv) * 100;
+	input.ZD = (float) (venv.values[Displacement] / cd) * 100;
+
+	input.HA = (float) (henv.values[Acceleration] / ca) * 100;
+	input.HV = (float) (henv.values[Velocity] / cv) * 100;
+	input.HD = (float) (henv.values[Displacement] / cd) * 100;
+
+	input.PSclass =
+			vs.psclass(input.ZA, input.ZV, input.HA, input.HV) == 0 ?
+					P_Wave : S_Wave;
+	input.SOILclass = soilClass;
+
+	input.mest = vs.mest(vs.ground_motion_ratio(input.ZA, input.ZD),
+			input.PSclass);
+
+	// Record single station magnitudes
+	station.waveformID.setNetworkCode(id.first);
+	station.waveformID.setStationCode(id.second);
+	station.waveformID.setLocationCode(locationCode);
+	station.waveformID.setChannelCode(channelCode);
+
+	// Logging, the lines are formatted on the log thread from copies
+	const VsInput values = input;
+	station.log.push_back([id, locationCode, channelCode, values] {
+		ostringstream out;
+		out.precision(2);
+		out.setf(ios::fixed, ios::floatfield);
+		out << "Sensor: " << id.first << "." << locationCode << ".";
+		out << id.second << "." << channelCode << "; ";
+		out << "Wavetype: " << std::string(values.PSclass.toString()) << "; ";
+		out << "Soil class: " << std::string(values.SOILclass.toString())
+				<< "; ";
+		out << "Magnitude: " << values.mest;
+		return out.str();
+	});
+	station.log.push_back([values, epicdist] {
+		ostringstream out;
+		out.precision(2);
+		out.setf(ios::fixed, ios::floatfield);
+		out << "station lat: " << values.lat << "; station lon: " << values.lon;
+		out << "; epicentral distance: " << epicdist << ";";
+		return out.str();
+	});
+	station.log.push_back([values] {
+		ostringstream out;
+		out.precision(2);
+		out.setf(ios::scientific, ios::floatfield);
+		out << "PGA(Z): " << values.ZA / 100. << "; PGV(Z): " << values.ZV / 100.;
+		out << "; PGD(Z): " << values.ZD / 100.;
+		return out.str();
+	});
+	station.log.push_back([values] {
+		ostringstream out;
+		out.precision(2);
+		out.setf(ios::scientific, ios::floatfield);
+		out << "PGA(H): " << values.HA / 100. << "; PGV(H): " << values.HV / 100.;
+		out << "; PGD(H): " << values.HD / 100.;
+		return out.str();
+	});
 }
 
 /*!
  \brief Process one event
 
- This is called by processEvents() when iterating over all events in the cache
+ This is called by processEvents() when iterating over all events in the cache.
+ It may run concurrently for different events and therefore only reads the
+ timeline and the inventory. Everything that has to be published is stored in
+ result.
+
+ Only stations that received envelopes within their time window since the
+ last run are recomputed. The grid search is skipped if none of the station
+ inputs changed.
  */
-void VsMagnitude::process(VsEvent *evt, Event *event) {
+void VsMagnitude::process(VsEvent *evt, Event *event, Origin *org,
+		VsResult &result) {
 	if ( evt->stations.empty() )
 		return;
-	Client::Inventory *inv = Client::Inventory::Instance();
+	VsEquations vs;
 
 	double stmag;
-	double distdg, epicdist, azi1, azi2;
-	WaveformStreamID wid;
-	ReturnCode ret;
 	Timeline::StationList unused;
 	evt->allThresholdStationsCount = 0;
 	vs.seteqlat(evt->lat);
 	vs.seteqlon(evt->lon);
 
 	vector<VsInput> inputs;
+	bool inputsChanged = !evt->gridValid;
 
-	SEISCOMP_LOG(_processingInfoChannel,
-			"Start logging for event: %s", event->publicID().c_str());
-	SEISCOMP_LOG(_processingInfoChannel, "update number: %d", evt->update);
+	const string publicID = event->publicID();
+	const int update = evt->update;
+	result.log.push_back([publicID] { return "Start logging for event: " + publicID; });
+	result.log.push_back([update] { return "update number: " + Core::toString(update); });
 
-	OriginPtr org = _cache.get<Origin>(event->preferredOriginID());
-		if ( !org ){
-			SEISCOMP_WARNING("Object %s not found in cache\nIs the cache size big enough?\n"
-								"Have you subscribed to all necessary message groups?",
-								event->preferredOriginID().c_str());
-			return;
+	if ( !org ){
+		SEISCOMP_WARNING("Object %s not found in cache\nIs the cache size big enough?\n"
+							"Have you subscribed to all necessary message groups?",
+							event->preferredOriginID().c_str());
+		evt->cache.clear();
+		evt->gridValid = false;
+		return;
 	}
 
-	evt->staMags.clear();
 	VsWindows::iterator it;
 	for ( it = evt->stations.begin(); it != evt->stations.end(); ++it ) {
-		Envelope venv, henv;
-		Core::Time vtime, htime;
-		string locationCode, channelCode;
+		VsStation &station = evt->cache[it->first];
 
+		bool changed = false;
+		if ( !isCached(station, it->first, it->second) ) {
+			bool hadInput = station.hasInput;
+			VsInput previous = station.input;
+			WaveformStreamID previousID = station.waveformID;
 
-		ret = _timeline.maxmimum(it->first, it->second.startTime(),
-				it->second.endTime(), it->second.pickTime(), venv, vtime, henv,
-				htime, locationCode, channelCode);
+			processStation(evt, it->first, it->second, station);
 
-		if ( no_data == ret ){
-			SEISCOMP_WARNING("No data available for %s.%s.%s", it->first.first.c_str(),
-					it->first.second.c_str(),locationCode.c_str());
-			unused.insert(it->first);
-			continue;
+			if ( station.hasInput != hadInput
+			  || (station.hasInput && !station.input.sameAs(previous)) ) {
+				inputsChanged = true;
+				changed = true;
+			}
+			else if ( !(station.waveformID == previousID) )
+				changed = true;
 		}
 
-		DataModel::SensorLocation *loc;
-		loc = inv->getSensorLocation(it->first.first, it->first.second,
-				locationCode, it->second.pickTime());
-		if ( loc == NULL ) {
-			SEISCOMP_WARNING(
-					"%s.%s.%s: sensor location not in inventory: ignoring", it->first.first.c_str(), it->first.second.c_str(), locationCode.c_str());
-			continue;
-		}
+		if ( station.unused )
+			unused.insert(it->first);
 
-		Math::Geo::delazi(evt->lat, evt->lon, loc->latitude(), loc->longitude(),
-				&distdg, &azi1, &azi2);
-		epicdist = Math::Geo::deg2km(distdg);
-
-		// if data is clipped or not enough to use it for magnitude
-		// computation add the station to the overall count and then continue
-		 if ( not_enough_data == ret || clipped_data == ret){
-			 SEISCOMP_WARNING("Not enough data available for %s.%s.%s", it->first.first.c_str(),
-						it->first.second.c_str(),locationCode.c_str());
-			 unused.insert(it->first);
-			 continue;
-		 }
-
-		// catch remaining errors
-		if ( index_error == ret || undefined_problem == ret)
+		if ( !station.hasInput )
 			continue;
 
-		if ( _maxepicdist > 0 ){
-			if( epicdist > _maxepicdist )
-				continue;
-		}
-
-		inputs.resize(inputs.size() + 1);
-		VsInput &input = inputs.back();
-		input.lat = (float) loc->latitude();
-		input.lon = (float) loc->longitude();
-
-		SoilClass soilClass;
-		float ca = siteEffect(input.lat, input.lon,
-				std::max(venv.values[Acceleration], henv.values[Acceleration]),
-				Acceleration, soilClass);
-		float cv = siteEffect(input.lat, input.lon,
-				std::max(venv.values[Velocity], henv.values[Velocity]),
-				Velocity, soilClass);
-		float cd = siteEffect(input.lat, input.lon,
-				std::max(venv.values[Displacement], henv.values[Displacement]),
-				Displacement, soilClass);
-
-		// Convert from m to cm and apply site effect correction
-		input.ZA = (float) (venv.values[Acceleration] / ca) * 100;
-		input.ZV = (float) (venv.values[Velocity] / cv) * 100;
-		input.ZD = (float) (venv.values[Displacement] / cd) * 100;
-
-		input.HA = (float) (henv.values[Acceleration] / ca) * 100;
-		input.HV = (float) (henv.values[Velocity] / cv) * 100;
-		input.HD = (float) (henv.values[Displacement] / cd) * 100;
-
-		input.PSclass =
-				vs.psclass(input.ZA, input.ZV, input.HA, input.HV) == 0 ?
-						P_Wave : S_Wave;
-		input.SOILclass = soilClass;
-
-		input.mest = vs.mest(vs.ground_motion_ratio(input.ZA, input.ZD),
-				input.PSclass);
-
-		// Record single station magnitudes
-		Notifier::SetEnabled(true);
-		_creationInfo.setCreationTime(Core::Time::GMT()); // was "_currentTime);" before but didn't allow sub-second precision.
-		_creationInfo.setModificationTime(Core::None);
-		DataModel::StationMagnitudePtr staMag = DataModel::StationMagnitude::Create();
-		staMag->setMagnitude(RealQuantity(input.mest));
-		staMag->setType("MVS");
-		staMag->setCreationInfo(_creationInfo);
-		wid.setNetworkCode(it->first.first);
-		wid.setStationCode(it->first.second);
-		wid.setLocationCode(locationCode);
-		wid.setChannelCode(channelCode);
-		staMag->setWaveformID(wid);
-		org->add(staMag.get());
-		evt->staMags.push_back(staMag);
-		Notifier::SetEnabled(false);
-
-		// Logging
-		string resultstr;
-		ostringstream out;
-		out.precision(2);
-		out.setf(ios::fixed, ios::floatfield);
-		out << "Sensor: " << it->first.first << "." << locationCode << ".";
-		out << it->first.second << "." << channelCode << "; ";
-		out << "Wavetype: " << std::string(input.PSclass.toString()) << "; ";
-		out << "Soil class: " << std::string(input.SOILclass.toString())
-				<< "; ";
-		out << "Magnitude: " << input.mest;
-		resultstr = out.str();
-		out.str("");
-		SEISCOMP_LOG(_processingInfoChannel, "%s", resultstr.c_str());
-		out.precision(2);
-		out.setf(ios::fixed, ios::floatfield);
-		out << "station lat: " << input.lat << "; station lon: " << input.lon;
-		out << "; epicentral distance: " << epicdist << ";";
-		resultstr = out.str();
-		out.str("");
-		SEISCOMP_LOG(_processingInfoChannel, "%s", resultstr.c_str());
-		out.precision(2);
-		out.setf(ios::scientific, ios::floatfield);
-		out << "PGA(Z): " << input.ZA / 100. << "; PGV(Z): " << input.ZV / 100.;
-		out << "; PGD(Z): " << input.ZD / 100.;
-		resultstr = out.str();
-		out.str("");
-		SEISCOMP_LOG(_processingInfoChannel, "%s", resultstr.c_str());
-		out << "PGA(H): " << input.HA / 100. << "; PGV(H): " << input.HV / 100.;
-		out << "; PGD(H): " << input.HD / 100.;
-		resultstr = out.str();
-		SEISCOMP_LOG(_processingInfoChannel, "%s", resultstr.c_str());
+		inputs.push_back(station.input);
+		result.staMags.resize(result.staMags.size() + 1);
+		result.staMags.back().station = it->first;
+		result.staMags.back().magnitude = station.input.mest;
+		result.staMags.back().waveformID = station.waveformID;
+		result.staMags.back().changed = changed;
+		result.log.insert(result.log.end(), station.log.begin(),
+		                  station.log.end());
 	}
 
 	if ( inputs.empty() ) {
-		SEISCOMP_LOG(_processingInfoChannel,
-				"End logging for event: %s", event->publicID().c_str());
+		result.log.push_back([publicID] { return "End logging for event: " + publicID; });
 		return;
 	}
 
 	// Grid search
-	float mag = 0.5f;
-	float minL = -1.0f;
-	float minMag = mag;
-
-	while ( mag <= 9.0f ) {
-		float L = 0.0f;
-
+	if ( inputsChanged ) {
+		vector<VsEquations::StationTerms> terms;
+		terms.reserve(inputs.size());
 		for ( size_t i = 0; i < inputs.size(); ++i ) {
 			const VsInput &input = inputs[i];
 
-			if ( Math::isNaN(input.mest)  ) {
-                                continue ;
-                        }
-
-			// Likelihood
-			vs.setmag(mag);
-			L += vs.likelihood(input.ZA, input.ZV, input.ZD, input.HA, input.HV,
-					input.HD, input.PSclass, input.SOILclass, input.lat,
-					input.lon);
-		}
+			if ( Math::isNaN(input.mest) )
+				continue;
 
-		if ( minL < 0 || minL > L ) {
-			minL = L;
-			minMag = mag;
+			terms.push_back(vs.stationterms(input.ZA, input.ZV, input.ZD,
+					input.HA, input.HV, input.HD, input.PSclass,
+					input.SOILclass, input.lat, input.lon));
 		}
 
-		mag += 0.01f;
+		Core::Time start = Core::Time::GMT();
+		float minL;
+		evt->gridMagnitude = vs.gridsearch(terms, minL);
+		evt->gridValid = true;
+		result.gridSearchTime = (double) (Core::Time::GMT() - start);
 	}
 
+	float minMag = evt->gridMagnitude;
+
 	// calculate the median of all station magnitudes
 	size_t size = inputs.size();
 	double *mestarray = new double[size];
@@ -991,77 +1404,99 @@ void VsMagnitude::process(VsEvent *evt, Event *event) {
 		evt->isValid = true;
 	}
 
-	// logging
-	string resultstr;
-	ostringstream out;
-	out.precision(2);
-	out.setf(ios::fixed, ios::floatfield);
-	out << "VS-mag: " << minMag << "; median single-station-mag: " << stmag;
-	out << "; lat: " << evt->lat << "; lon: " << evt->lon;
-	out << "; depth : " << evt->dep << " km";
-	resultstr = out.str();
-	out.str("");
-	SEISCOMP_LOG(_processingInfoChannel, "%s", resultstr.c_str());
+	// logging, the lines are formatted on the log thread from copies
+	const double lat = evt->lat, lon = evt->lon, dep = evt->dep;
+	result.log.push_back([minMag, stmag, lat, lon, dep] {
+		ostringstream out;
+		out.precision(2);
+		out.setf(ios::fixed, ios::floatfield);
+		out << "VS-mag: " << minMag << "; median single-station-mag: " << stmag;
+		out << "; lat: " << lat << "; lon: " << lon;
+		out << "; depth : " << dep << " km";
+		return out.str();
+	});
 
-	out << "creation time: " << _currentTime.toString("%FT%T.%2fZ");
-	out << "; origin time: " << evt->time.toString("%FT%T.%2fZ");
-	Core::TimeSpan difftime = _currentTime - evt->time;
+	const Core::Time currentTime = _currentTime, originTime = evt->time;
 	Core::Time now = Core::Time::GMT();
-	Core::TimeSpan difftime_oa = now - evt->originArrivalTime;
-	Core::TimeSpan difftime_ct = now - evt->originCreationTime;
-	out << "; t-diff: " << difftime.length();
-	out.precision(3);
-	out << "; time since origin arrival: " << difftime_oa.length();
-	out << "; time since origin creation: " << difftime_ct.length();
-	resultstr = out.str();
-	out.str("");
-	SEISCOMP_LOG(_processingInfoChannel, "%s", resultstr.c_str());
-
-	out << "# picked stations: " << evt->pickedStationsCount; // all stations with picks
-	out << "; # envelope streams: " << _timeline.StreamCount(); // all stations with envelope streams
-	resultstr = out.str();
-	out.str("");
-	SEISCOMP_LOG(_processingInfoChannel, "%s", resultstr.c_str());
+	const Core::TimeSpan difftime_oa = now - evt->originArrivalTime;
+	const Core::TimeSpan difftime_ct = now - evt->originCreationTime;
+	result.log.push_back([currentTime, originTime, difftime_oa, difftime_ct] {
+		ostringstream out;
+		out.precision(2);
+		out.setf(ios::fixed, ios::floatfield);
+		out << "creation time: " << currentTime.toString("%FT%T.%2fZ");
+		out << "; origin time: " << originTime.toString("%FT%T.%2fZ");
+		Core::TimeSpan difftime = currentTime - originTime;
+		out << "; t-diff: " << difftime.length();
+		out.precision(3);
+		out << "; time since origin arrival: " << difftime_oa.length();
+		out << "; time since origin creation: " << difftime_ct.length();
+		return out.str();
+	});
+
+	const int pickedStationsCount = evt->pickedStationsCount;
+	const int streamCount = _timeline.StreamCount();
+	result.log.push_back([pickedStationsCount, streamCount] {
+		ostringstream out;
+		out << "# picked stations: " << pickedStationsCount; // all stations with picks
+		out << "; # envelope streams: " << streamCount; // all stations with envelope streams
+		return out.str();
+	});
 
 	// distance threshold for delta-pick quality criteria
-	out.precision(2);
-	out << "Distance threshold (dt): " << Math::Geo::deg2km(evt->dthresh)
-			<< " km";
-	out << "; # picked stations < dt: " << evt->pickedThresholdStationsCount;
-	out << "; # envelope streams < dt: " << evt->allThresholdStationsCount;
-	resultstr = out.str();
-	out.str("");
-	SEISCOMP_LOG(_processingInfoChannel, "%s", resultstr.c_str());
+	const double dthresh = evt->dthresh;
+	const int pickedThresholdStationsCount = evt->pickedThresholdStationsCount;
+	const int allThresholdStationsCount = evt->allThresholdStationsCount;
+	result.log.push_back([dthresh, pickedThresholdStationsCount,
+	                      allThresholdStationsCount] {
+		ostringstream out;
+		out.precision(2);
+		out.setf(ios::fixed, ios::floatfield);
+		out << "Distance threshold (dt): " << Math::Geo::deg2km(dthresh)
+				<< " km";
+		out << "; # picked stations < dt: " << pickedThresholdStationsCount;
+		out << "; # envelope streams < dt: " << allThresholdStationsCount;
+		return out.str();
+	});
 
 	if (evt->pickedStationsCount > evt->vsStationCount){
-		out << "Stations not used for VS-mag: ";
 		// find picked stations that don't contribute to the VS magnitude
+		vector<Timeline::StationID> notUsed;
 		Timeline::StationList &sl = evt->pickedStations;
 		for (Timeline::StationList::iterator it=sl.begin(); it!=sl.end(); ++it){
 			if ( evt->stations.find(*it) == evt->stations.end() || unused.find(*it) != unused.end()) {
-				out << (*it).first << '.' << (*it).second << ' ';
+				notUsed.push_back(*it);
 			}
 		}
-		resultstr = out.str();
-		out.str("");
-		SEISCOMP_LOG(_processingInfoChannel, "%s", resultstr.c_str());
+		result.log.push_back([notUsed] {
+			ostringstream out;
+			out << "Stations not used for VS-mag: ";
+			for ( size_t i = 0; i < notUsed.size(); ++i )
+				out << notUsed[i].first << '.' << notUsed[i].second << ' ';
+			return out.str();
+		});
 	}
 
-	out.precision(3);
-	out << "Magnitude check: " << deltamag << "; Arrivals check: " << deltapick;
-	out << "; Azimuthal gap: " << evt->azGap;
-	resultstr = out.str();
-	out.str("");
-	SEISCOMP_LOG(_processingInfoChannel, "%s", resultstr.c_str());
+	const double azGap = evt->azGap;
+	result.log.push_back([deltamag, deltapick, azGap] {
+		ostringstream out;
+		out.precision(3);
+		out.setf(ios::fixed, ios::floatfield);
+		out << "Magnitude check: " << deltamag << "; Arrivals check: " << deltapick;
+		out << "; Azimuthal gap: " << azGap;
+		return out.str();
+	});
 
-	out.precision(2);
-	out << "likelihood: " << evt->likelihood;
-	resultstr = out.str();
-	out.str("");
-	SEISCOMP_LOG(_processingInfoChannel, "%s", resultstr.c_str());
+	const double likelihood = evt->likelihood;
+	result.log.push_back([likelihood] {
+		ostringstream out;
+		out.precision(2);
+		out.setf(ios::fixed, ios::floatfield);
+		out << "likelihood: " << likelihood;
+		return out.str();
+	});
 
-	SEISCOMP_LOG(_processingInfoChannel,
-			"End logging for event: %s", event->publicID().c_str());
+	result.log.push_back([publicID] { return "End logging for event: " + publicID; });
 }
 
 /*!
@@ -50,6 +50,8 @@
 #include <seiscomp/math/geo.h>
 
 #include <algorithm>
+#include <deque>
+#include <mutex>
 #include <sstream>
 #include <vector>
 
@@ -57,6 +59,9 @@
 #include "timeline.h"
 #include "Vs30Mapping.h"
 #include "VsSiteCondition.h"
+#include "workerpool.h"
+#include "asynclog.h"
+#include "statistics.h"
 
 namespace Seiscomp {
 
@@ -82,6 +87,53 @@ protected:
 	typedef std::map<Timeline::StationID, VsTimeWindow> VsWindows;
 	typedef std::vector<DataModel::StationMagnitudeCPtr> StaMagArray;
 
+	/**
+	 Input structure for final VS magnitude computation.
+	 This should also hold all values that are not dependent on the input
+	 magnitude of the grid search. The grid search should use those values to
+	 not compute values redundantly. And at the end these values (e.g. station
+	 magnitude) should be used to compute the RMS of the final magnitude.
+	 */
+	struct VsInput {
+		float ZA, ZV, ZD, HA, HV, HD;
+		WaveType PSclass;
+		SoilClass SOILclass;
+		float lat, lon;
+		float mest;
+
+		//! Compares all members where NaN values compare equal
+		bool sameAs(const VsInput &other) const;
+	};
+
+	/**
+	 Result of processing one station of an event. It is kept between two
+	 runs of process() and only recomputed if envelopes of the station within
+	 its time window have been received in the meantime.
+	 */
+	struct VsStation {
+		VsStation()
+		: valid(false), complete(false), unused(false), hasInput(false),
+		  sensors(0), input() {}
+
+		bool valid;
+		// Whether the time window was completely inside the timeline
+		bool complete;
+		// Whether the station counts as not used for the VS magnitude
+		bool unused;
+		// Whether input holds a station magnitude
+		bool hasInput;
+		// Number of sensors of the station in the timeline
+		int sensors;
+		VsInput input;
+		DataModel::WaveformStreamID waveformID;
+		// The last published station magnitude
+		DataModel::StationMagnitudeCPtr staMag;
+		// Lines for the processing info log, formatted by the log thread
+		std::vector<AsyncLog::Formatter> log;
+	};
+
+	typedef std::map<Timeline::StationID, VsStation> VsStations;
+
 	DEFINE_SMARTPOINTER(VsEvent);
 	struct VsEvent: Core::BaseObject {
 		double lat;
@@ -105,16 +157,80 @@ protected:
 		double maxAzGap;
 		int update;
 		double likelihood;
+		// Results of the last run of process(), cleared whenever the
+		// preferred origin changes
+		VsStations cache;
+		bool gridValid;
+		float gridMagnitude;
+	};
+
+	/**
+	 Output of process() that has to be published from the main thread
+	 after all events have been processed.
+	 */
+	struct VsResult {
+		struct StationMagnitude {
+			Timeline::StationID station;
+			double magnitude;
+			DataModel::WaveformStreamID waveformID;
+			// Whether the magnitude differs from the last published one
+			bool changed;
+		};
+
+		std::vector<StationMagnitude> staMags;
+		// Lines for the processing info log, formatted by the log thread
+		std::vector<AsyncLog::Formatter> log;
+		// Wall clock durations in seconds, the grid search time is
+		// negative if the grid search was skipped
+		double processingTime;
+		double gridSearchTime;
+	};
+
+	//! Counters and histograms reported every vsmag.statsInterval seconds
+	struct Statistics {
+		Statistics() : envelopes(0), ignoredEnvelopes(0) {}
+
+		size_t envelopes;
+		size_t ignoredEnvelopes;
+		// Wall clock time minus envelope timestamp at arrival
+		Histogram envelopeAge;
+		Histogram processingTime;
+		Histogram gridSearchTime;
+		// Timeline counters at the last report
+		Timeline::Statistics timeline;
 	};
 
 	typedef std::map<std::string, VsEventPtr> VsEvents;
+
+	struct Site {
+		Site() : initialized(false), valid(false), vs30(0) {}
+		bool initialized;
+		bool valid;
+		float vs30;
+	};
+	//! Vs30 lookup results keyed by latitude and longitude
+	typedef std::map<std::pair<double, double>, Site> SiteCache;
+
+	//! Time span of envelopes received per station since the last run of
+	//! processEvents()
+	typedef std::map<Timeline::StationID, Core::TimeWindow> StationUpdates;
 	typedef std::map<std::string, Core::Time> EventIDBuffer;
+
+	//! The part of a pick needed to process events
+	struct PickInfo {
+		Timeline::StationID station;
+		Core::Time time;
+	};
+	typedef std::map<std::string, PickInfo> PickIndex;
+	//! Indexed picks in the order they were received
+	typedef std::deque<std::pair<Core::Time, std::string> > PickOrder;
 	typedef DataModel::PublicObjectTimeSpanBuffer Cache;
 
 	void createCommandLineDescription();
 	bool initConfiguration();
 	bool init();
 	bool validateParameters();
+	bool run();
 
 	void handleMessage(Core::Message* msg);
 	void handleTimeout();
@@ -125,11 +241,21 @@ protected:
 
 	void handleEvent(DataModel::Event *event);
 	void handlePick(DataModel::Pick *pk);
+	void indexPick(const DataModel::Pick *pk);
+	void fetchPicks(const DataModel::Origin *org);
 	void handleOrigin(DataModel::Origin *og);
 
 	void processEvents();
-	void process(VsEvent *vsevt, DataModel::Event *event);
+	void process(VsEvent *vsevt, DataModel::Event *event,
+			DataModel::Origin *org, VsResult &result);
+	bool isCached(const VsStation &station, const Timeline::StationID &id,
+			const VsTimeWindow &tw) const;
+	void processStation(const VsEvent *vsevt, const Timeline::StationID &id,
+			const VsTimeWindow &tw, VsStation &station);
+	void publish(VsEvent *vsevt, DataModel::Origin *org,
+			const VsResult &result);
 	void updateVSMagnitude(DataModel::Event *event, VsEvent *vsevt);
+	void reportStatistics();
 	template<typename T>
 	bool setComments(DataModel::Magnitude *mag, const std::string id,
 			const T value);
@@ -148,11 +274,21 @@ protected:
 	float siteEffect(double lat, double lon, double MA, ValueType valueType,
 			SoilClass &soilClass);
 
+	/**
+	 Returns the Vs30 value of a site. The value is looked up once per
+	 coordinate and then taken from the site cache.
+	 @return false if the lookup failed
+	 */
+	bool siteVs30(double lat, double lon, float &vs30);
+
 private:
 	Cache _cache;
 	EventIDBuffer _publishedEvents;
+	PickIndex _picks;
+	PickOrder _pickOrder;
 	Timeline _timeline;
 	VsEvents _events;
+	StationUpdates _updates;
 	Core::Time _currentTime;
 	Core::Time _lastProcessingTime;
 	DataModel::CreationInfo _creationInfo;
@@ -162,9 +298,13 @@ private:
 	Logging::FdOutput* _processingInfoOutput;
 	Logging::Channel* _envelopeInfoChannel;
 	Logging::Output* _envelopeInfoFile;
+	Logging::Channel* _statisticsChannel;
+	Logging::Output* _statisticsFile;
+	AsyncLog _log;
 
 	// Configuration
 	std::string _vs30filename;
+	std::string _vs30raster; // output of --convert-vs30
 	std::string _proclogfile;
 	std::string appname;
 	int _backSlots;
@@ -175,12 +315,23 @@ private:
 	int _eventExpirationTime; // number seconds after origin time the calculation of vsmagnitudes is stopped
 	std::string _expirationTimeReference;
 	double _vs30default;
+	bool _vs30interpolation; // bilinear interpolation of the Vs30 grid
 	int _clipTimeout;
 	int _timeout;
 	bool _siteEffect; // turn site effects on or off
 	double _maxepicdist;
 	double _maxazgap;
 	bool _logenvelopes;
+	int _threads; // number of events processed concurrently
+	int _statsInterval; // seconds between statistics reports, 0 disables them
+
+	Statistics _statistics;
+	Core::Time _lastStatisticsTime;
+
+	SiteCache _sites;
+	std::mutex _siteMutex;
+
+	WorkerPool _workers;
 };
 
 }
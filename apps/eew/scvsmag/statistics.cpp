@@ -0,0 +1,74 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ ***************************************************************************/
+
+#include "statistics.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace Seiscomp {
+
+Histogram::Histogram() {
+	for ( double decade = 0.001; decade < 1000; decade *= 10 ) {
+		_limits.push_back(decade);
+		_limits.push_back(2 * decade);
+		_limits.push_back(5 * decade);
+	}
+	_limits.push_back(1000);
+	_counts.resize(_limits.size() + 1);
+	reset();
+}
+
+void Histogram::add(double value) {
+	size_t i = 0;
+	while ( i < _limits.size() && value > _limits[i] )
+		++i;
+	++_counts[i];
+
+	if ( _count == 0 || value > _max )
+		_max = value;
+	_sum += value;
+	++_count;
+}
+
+void Histogram::reset() {
+	std::fill(_counts.begin(), _counts.end(), 0);
+	_count = 0;
+	_sum = 0;
+	_max = 0;
+}
+
+double Histogram::quantile(double q) const {
+	size_t n = 0;
+	for ( size_t i = 0; i < _limits.size(); ++i ) {
+		n += _counts[i];
+		if ( n >= q * _count )
+			return _limits[i];
+	}
+	return _max;
+}
+
+std::string Histogram::toString() const {
+	if ( _count == 0 )
+		return "n=0";
+
+	char buf[256];
+	snprintf(buf, sizeof(buf),
+	         "n=%lu mean=%.3fs max=%.3fs p50<=%gs p90<=%gs p99<=%gs",
+	         (unsigned long)_count, _sum / _count, _max, quantile(0.5),
+	         quantile(0.9), quantile(0.99));
+	return buf;
+}
+
+}
@@ -0,0 +1,59 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ ***************************************************************************/
+
+#ifndef __SEISCOMP_APPLICATIONS_SCVSMAG_STATISTICS_H__
+#define __SEISCOMP_APPLICATIONS_SCVSMAG_STATISTICS_H__
+
+#include <string>
+#include <vector>
+
+namespace Seiscomp {
+
+/**
+ \brief Histogram of durations or ages in seconds.
+
+ The bucket limits grow in 1-2-5 steps from one millisecond up to 1000
+ seconds. Values above the last limit are counted in an overflow bucket.
+ */
+class Histogram {
+public:
+	Histogram();
+
+	void add(double value);
+	void reset();
+
+	size_t count() const {
+		return _count;
+	}
+
+	/**
+	 Returns a summary with the number of values, mean, maximum and the
+	 bucket limits below which 50, 90 and 99 percent of the values lie.
+	 */
+	std::string toString() const;
+
+private:
+	//! Returns the upper bucket limit of a quantile
+	double quantile(double q) const;
+
+	std::vector<double> _limits;
+	std::vector<size_t> _counts;
+	size_t _count;
+	double _sum;
+	double _max;
+};
+
+}
+
+#endif
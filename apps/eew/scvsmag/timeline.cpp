@@ -22,22 +22,297 @@
 #include "timeline.h"
 #include "util.h"
 
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+using namespace std;
+
+namespace Seiscomp {
+
+namespace {
+
+const uint8_t ClipZH = (1 << Z) | (1 << H);
+
 /*!
- \brief The timeline contains the ringbuffer that caches incoming envelope data.
+ \brief A time window of the timeline mapped to at most two contiguous
+ ranges of the envelope arena.
 
- It has a time resolution of one second.
+ The ranges are ordered in time. Each range holds the arena offset of its
+ first slot and the logical buffer index that belongs to it.
+ */
+struct Window {
+	struct Range {
+		int offset;
+		int index;
+		int length;
+	};
+
+	Window(int head, int bufferSize, int blockSize, int first, int last)
+	: count(0), bufferSize(bufferSize), blockSize(blockSize) {
+		if ( last < first )
+			return;
+		int physical = head + first;
+		if ( physical >= bufferSize )
+			physical -= bufferSize;
+		int length = last - first + 1;
+		int tail = bufferSize - physical;
+		if ( length <= tail ) {
+			add(physical, first, length);
+		} else {
+			add(physical, first, tail);
+			add(0, first + tail, length - tail);
+		}
+	}
+
+	void add(int offset, int index, int length) {
+		ranges[count].offset = offset;
+		ranges[count].index = index;
+		ranges[count].length = length;
+		++count;
+	}
 
+	Range ranges[2];
+	int count;
+	int bufferSize;
+	int blockSize;
+};
 
+/*!
+ \brief A part of a window that lies within a single block of the arena.
+
+ If full is set the span covers the complete block and the block summary
+ can be used instead of the slots.
  */
+struct Span {
+	int begin;
+	int end;
+	int index;
+	int block;
+	bool full;
+};
+
+//! Iterates over the spans of a window in time order
+class SpanIterator {
+	public:
+		SpanIterator(const Window &w)
+		: _window(w), _range(0), _pos(w.count ? w.ranges[0].offset : 0) {}
+
+		bool next(Span &s) {
+			while ( _range < _window.count ) {
+				const Window::Range &r = _window.ranges[_range];
+				int end = r.offset + r.length;
+				if ( _pos < end ) {
+					s.block = _pos / _window.blockSize;
+					int blockBegin = s.block * _window.blockSize;
+					int blockEnd = std::min(blockBegin + _window.blockSize,
+					                        _window.bufferSize);
+					s.begin = _pos;
+					s.end = std::min(blockEnd, end);
+					s.index = r.index + (_pos - r.offset);
+					s.full = s.begin == blockBegin && s.end == blockEnd;
+					_pos = s.end;
+					return true;
+				}
 
-using namespace std;
+				if ( ++_range < _window.count )
+					_pos = _window.ranges[_range].offset;
+			}
 
-namespace Seiscomp {
+			return false;
+		}
+
+	private:
+		const Window &_window;
+		int _range;
+		int _pos;
+};
+
+//! A searchable Z or H column of a sensor
+struct Column {
+	const float *values;
+	const float *blockMax;
+};
+
+/*!
+ \brief Returns the largest non-negative value of a column in the given
+ window ignoring all slots where Z or H are clipped. If no value is found
+ a negative value is returned.
+ */
+float columnMax(const Column &col, const uint8_t *mask, const Window &w) {
+	float m = -1;
+	SpanIterator it(w);
+	Span s;
+	while ( it.next(s) ) {
+		if ( s.full ) {
+			float x = col.blockMax[s.block];
+			m = x > m ? x : m;
+			continue;
+		}
+
+		for ( int i = s.begin; i < s.end; ++i ) {
+			float x = (mask[i] & ClipZH) ? -1.0f : col.values[i];
+			m = x > m ? x : m;
+		}
+	}
+	return m;
+}
+
+/*!
+ \brief Returns the first logical index in the window of an unclipped value
+ equal to value (if exact is true) or greater than value and not negative
+ (if exact is false). If no such value exists -1 is returned.
+ */
+int columnFind(const Column &col, const uint8_t *mask, const Window &w,
+               float value, bool exact) {
+	SpanIterator it(w);
+	Span s;
+	while ( it.next(s) ) {
+		if ( s.full ) {
+			float x = col.blockMax[s.block];
+			if ( exact ? x != value : !(x >= 0 && x > value) )
+				continue;
+		}
+
+		for ( int i = s.begin; i < s.end; ++i ) {
+			if ( mask[i] & ClipZH )
+				continue;
+			float v = col.values[i];
+			if ( exact ? v == value : (v >= 0 && v > value) )
+				return s.index + (i - s.begin);
+		}
+	}
+	return -1;
+}
+
+/*!
+ \brief Searches the maximum of one column of a sensor in a time window.
+
+ This is the column wise equivalent of updating the running maximum max
+ slot by slot: if a larger value exists in the window then max is set to
+ it, maxIdx to the first slot holding it and the first and last slot
+ where the running maximum was raised are merged into minIdx and lastIdx.
+ */
+void updateMaximum(const Column &col, const uint8_t *mask, const Window &w,
+                   float &max, int &maxIdx, int &minIdx, int &lastIdx) {
+	float m = columnMax(col, mask, w);
+	if ( m < 0 || !(m > max) )
+		return;
+
+	int first = columnFind(col, mask, w, max, false);
+	maxIdx = columnFind(col, mask, w, m, true);
+	max = m;
+
+	if ( first < minIdx )
+		minIdx = first;
+	if ( maxIdx > lastIdx )
+		lastIdx = maxIdx;
+}
+
+/*!
+ \brief Returns the logical index of the latest slot in the window where
+ Z is set and neither Z nor H are clipped or -1 if there is none.
+ */
+int latestEntry(const Column z[ValueTypeQuantity], const uint8_t *mask,
+                const Window &w) {
+	SpanIterator it(w);
+	Span s, last;
+	bool found = false;
+
+	// Find the latest span with an entry using the block summaries ...
+	while ( it.next(s) ) {
+		bool hasEntry = false;
+		if ( s.full ) {
+			for ( int v = 0; v < ValueTypeQuantity; ++v )
+				hasEntry = hasEntry || z[v].blockMax[s.block] >= 0;
+		}
+		else {
+			for ( int i = s.begin; i < s.end && !hasEntry; ++i ) {
+				if ( mask[i] & ClipZH )
+					continue;
+				for ( int v = 0; v < ValueTypeQuantity; ++v )
+					hasEntry = hasEntry || z[v].values[i] >= 0;
+			}
+		}
+
+		if ( hasEntry ) {
+			last = s;
+			found = true;
+		}
+	}
+
+	if ( !found )
+		return -1;
+
+	// ... and the latest entry inside of it
+	for ( int i = last.end - 1; i >= last.begin; --i ) {
+		if ( mask[i] & ClipZH )
+			continue;
+		for ( int v = 0; v < ValueTypeQuantity; ++v ) {
+			if ( z[v].values[i] >= 0 )
+				return last.index + (i - last.begin);
+		}
+	}
+
+	return -1;
+}
+
+//! Returns the one degree grid cell of value clamped to [0,cells)
+int gridCell(double value, int cells) {
+	int cell = (int)floor(value);
+	return cell < 0 ? 0 : (cell >= cells ? cells - 1 : cell);
+}
+
+//! Maps a longitude to [-180,180)
+double normalizedLongitude(double lon) {
+	lon = fmod(lon + 180, 360);
+	if ( lon < 0 )
+		lon += 360;
+	return lon - 180;
+}
+
+/*!
+ \brief Checks whether Z or H are clipped in any slot of the window.
+ */
+bool anyClipped(const uint8_t *mask, const uint16_t *blockClipped,
+                const Window &w) {
+	SpanIterator it(w);
+	Span s;
+	while ( it.next(s) ) {
+		if ( s.full ) {
+			if ( blockClipped[s.block] > 0 )
+				return true;
+			continue;
+		}
+
+		for ( int i = s.begin; i < s.end; ++i ) {
+			if ( mask[i] & ClipZH )
+				return true;
+		}
+	}
+	return false;
+}
+
+}
+
+/*!
+ \brief The timeline contains the ringbuffer that caches incoming envelope data.
+
+ It has a time resolution of one second.
+
+ Envelopes of all sensors are stored column wise in a single arena so that
+ scans over a time window run over contiguous memory.
+ */
 
 void Timeline::init(int past, int future, int timeout) {
 	_headSlots = future;
 	_backSlots = past;
 	_clipTimeout = timeout;
+	_bufferSize = _headSlots + _backSlots;
+	_head = 0;
+	_origin = 0;
+	_statistics = Statistics();
+	_blockCount = (_bufferSize + BlockSize - 1) / BlockSize;
 }
 
 bool Timeline::setReferenceTime(const Core::Time &ref) {
@@ -54,7 +329,7 @@ bool Timeline::setReferenceTime(const Core::Time &ref) {
 	return step(steps);
 }
 
-int Timeline::StreamCount(){
+int Timeline::StreamCount() const {
 	return _stations.size();
 }
 
@@ -67,20 +342,98 @@ int Timeline::StreamCount(){
 bool Timeline::step(int secs) {
 	_referenceTime += Core::TimeSpan(secs, 0);
 
-	Stations::iterator it;
-	for ( it = _stations.begin(); it != _stations.end(); ++it ) {
-		SensorBuffers *buf = it->second.get();
-		SensorBuffers::iterator sit;
-		for ( sit = buf->begin(); sit != buf->end(); ++sit ) {
-			// Shift buffer
-			for ( int i = 0; i < secs; ++i )
-				(*sit)->buffer.push_back(Cell());
+	if ( secs <= 0 || _bufferSize <= 0 )
+		return true;
+
+	// The slots that are shifted out at the front are reused as the
+	// newest slots at the end of the buffer.
+	int n = std::min(secs, _bufferSize);
+	Window w(_head, _bufferSize, BlockSize, 0, n - 1);
+
+	for ( size_t s = 0; s < _sensors.size(); ++s ) {
+		for ( int c = 0; c < ComponentQuantity; ++c ) {
+			for ( int v = 0; v < ValueTypeQuantity; ++v ) {
+				float *values = column(s, c, v);
+				for ( int r = 0; r < w.count; ++r )
+					std::fill_n(values + w.ranges[r].offset, w.ranges[r].length, -1.0f);
+			}
+		}
+
+		uint8_t *mask = clipMask(s);
+		for ( int r = 0; r < w.count; ++r )
+			std::fill_n(mask + w.ranges[r].offset, w.ranges[r].length, 0);
+
+		for ( int r = 0; r < w.count; ++r ) {
+			int first = w.ranges[r].offset / BlockSize;
+			int last = (w.ranges[r].offset + w.ranges[r].length - 1) / BlockSize;
+			for ( int b = first; b <= last; ++b )
+				updateBlock(s, b);
 		}
 	}
 
+	_head = (_head + secs) % _bufferSize;
+	_origin += secs;
+
 	return true;
 }
 
+Timeline::StationHandle Timeline::station(const StationID &id) const {
+	StationIndex::const_iterator it = _stationIndex.find(id);
+	if ( it == _stationIndex.end() )
+		return -1;
+	return it->second;
+}
+
+bool Timeline::covers(const Core::Time &start, const Core::Time &end) const {
+	int start_idx = (int) (start - _referenceTime).seconds() + _backSlots;
+	int end_idx = (int) (end - _referenceTime).seconds() + _backSlots;
+	return start_idx >= 0 && end_idx < _bufferSize;
+}
+
+int Timeline::sensorCount(const StationID &id) const {
+	StationHandle handle = station(id);
+	if ( handle < 0 )
+		return 0;
+	return _stations[handle].sensors.size();
+}
+
+Timeline::SensorHandle Timeline::addSensor(const Sensor &sensor) {
+	SensorHandle handle = _sensors.size();
+	_sensors.push_back(sensor);
+
+	// Fill buffer with empty values
+	_values.resize(_values.size() + (size_t)ColumnQuantity * _bufferSize, -1.0f);
+	_clipMask.resize(_clipMask.size() + _bufferSize, 0);
+	_blockMax.resize(_blockMax.size() + (size_t)SearchColumnQuantity * _blockCount, -1.0f);
+	_blockClipped.resize(_blockClipped.size() + _blockCount, 0);
+
+	return handle;
+}
+
+void Timeline::updateBlock(SensorHandle sensor, int block) {
+	int begin = block * BlockSize;
+	int end = std::min(begin + BlockSize, _bufferSize);
+	const uint8_t *mask = clipMask(sensor);
+
+	uint16_t clipped = 0;
+	for ( int i = begin; i < end; ++i )
+		clipped += (mask[i] & ClipZH) ? 1 : 0;
+	_blockClipped[(size_t)sensor * _blockCount + block] = clipped;
+
+	static const int components[] = {Z, H};
+	for ( int c = 0; c < 2; ++c ) {
+		for ( int v = 0; v < ValueTypeQuantity; ++v ) {
+			const float *values = column(sensor, components[c], v);
+			float m = -1;
+			for ( int i = begin; i < end; ++i ) {
+				float x = (mask[i] & ClipZH) ? -1.0f : values[i];
+				m = x > m ? x : m;
+			}
+			blockMax(sensor, components[c], v)[block] = m;
+		}
+	}
+}
+
 /*!
  \brief Add an incoming envelope message to the timeline
 
@@ -88,22 +441,19 @@ bool Timeline::step(int secs) {
  */
 bool Timeline::feed(const DataModel::VS::Envelope *env) {
 	StationID id(env->network(), env->station());
-	SensorBuffersPtr station;
-	Stations::iterator it;
+	StationHandle stationHandle = station(id);
 
-	it = _stations.find(id);
-	if ( it == _stations.end() ) {
-		station = SensorBuffersPtr(new SensorBuffers);
-		_stations[id] = station;
+	if ( stationHandle < 0 ) {
+		stationHandle = _stations.size();
+		_stations.push_back(Station());
+		_stations.back().id = id;
+		_stationIndex[id] = stationHandle;
 		SEISCOMP_DEBUG(
 				"create new station entry for %s.%s", id.first.c_str(), id.second.c_str());
-	} else
-		station = it->second;
+	}
 
 	int cnt = 0;
 
-	int bufferSize = _headSlots + _backSlots;
-
 	for ( size_t i = 0; i < env->envelopeChannelCount(); ++i ) {
 		DataModel::VS::EnvelopeChannel *cha = env->envelopeChannel(i);
 
@@ -112,31 +462,34 @@ bool Timeline::feed(const DataModel::VS::Envelope *env) {
 		if ( idx < 0 ) {
 			SEISCOMP_DEBUG(
 					"ignoring received envelope (too old, current time = %s)", _referenceTime.iso().c_str());
+			++_statistics.tooOld;
 			continue;
 		}
-		if ( idx >= bufferSize ) {
+		if ( idx >= _bufferSize ) {
 			SEISCOMP_DEBUG(
-					"ignoring received envelope (too far in the future, current time = %s, idx = %d, bufferSize = %d)", _referenceTime.iso().c_str(), idx, bufferSize);
+					"ignoring received envelope (too far in the future, current time = %s, idx = %d, bufferSize = %d)", _referenceTime.iso().c_str(), idx, _bufferSize);
+			++_statistics.tooNew;
 			continue;
 		}
 
-		SensorBuffers::iterator sit;
-		SensorBufferPtr sensor;
-		for ( sit = station->begin(); sit != station->end(); ++sit ) {
-			if ( cha->waveformID().locationCode() != (*sit)->locationCode )
+		const std::vector<SensorHandle> &sensors = _stations[stationHandle].sensors;
+		SensorHandle sensor = -1;
+		for ( size_t s = 0; s < sensors.size(); ++s ) {
+			const Sensor &candidate = _sensors[sensors[s]];
+			if ( cha->waveformID().locationCode() != candidate.locationCode )
 				continue;
-			if ( cha->waveformID().channelCode().compare(0, 2, (*sit)->streamCode) != 0 )
+			if ( cha->waveformID().channelCode().compare(0, 2, candidate.streamCode) != 0 )
 				continue;
-			sensor = *sit;
+			sensor = sensors[s];
 			break;
 		}
 
-		if ( !sensor ) {
+		if ( sensor < 0 ) {
 			Client::Inventory *inv = Client::Inventory::Instance();
 			DataModel::Stream *stream = inv->getStream(id.first, id.second,
 					cha->waveformID().locationCode(),
 					cha->waveformID().channelCode(), env->timestamp());
-			Processing::WaveformProcessor::SignalUnit signalUnit;
+			SignalUnit signalUnit;
 			if ( stream ) {
 				bool unitOK = false;
 				try {
@@ -146,27 +499,44 @@ bool Timeline::feed(const DataModel::VS::Envelope *env) {
 				if ( !unitOK ) {
 					SEISCOMP_ERROR(
 							"%s: unable to retrieve gain unit", Private::toStreamID(cha->waveformID()).c_str());
+					++_statistics.unknownStream;
 					continue;
 				}
 			} else {
 				SEISCOMP_ERROR(
 						"%s: unable to retrieve stream from inventory", Private::toStreamID(cha->waveformID()).c_str());
+				++_statistics.unknownStream;
 				continue;
 			}
 
-			sensor = SensorBufferPtr(new SensorBuffer(bufferSize));
-			sensor->locationCode = cha->waveformID().locationCode();
-			sensor->streamCode = cha->waveformID().channelCode().substr(0, 2);
-			sensor->sensorUnit = signalUnit;
+			Sensor info;
+			info.locationCode = cha->waveformID().locationCode();
+			info.streamCode = cha->waveformID().channelCode().substr(0, 2);
+			info.sensorUnit = signalUnit;
+			info.station = stationHandle;
+			info.lastVerticalVelocity = std::numeric_limits<int64_t>::min();
+
+			DataModel::SensorLocation *loc = inv->getSensorLocation(
+					id.first, id.second, info.locationCode, env->timestamp());
+			info.located = loc != NULL;
+			if ( loc ) {
+				info.latitude = loc->latitude();
+				info.longitude = loc->longitude();
+			}
+			else {
+				info.latitude = info.longitude = 0;
+				SEISCOMP_WARNING(
+						"%s.%s.%s: sensor location not in inventory: station will not be counted", id.first.c_str(), id.second.c_str(), info.locationCode.c_str());
+			}
 
-			// Fill buffer with empty values
-			for ( int i = 0; i < bufferSize; ++i )
-				sensor->buffer.push_back(Cell());
+			sensor = addSensor(info);
 
 			SEISCOMP_DEBUG(
-					"create new buffer for %s.%s.%s.%s with size %d/%d", id.first.c_str(), id.second.c_str(), sensor->locationCode.c_str(), sensor->streamCode.c_str(), (int)sensor->buffer.size(), bufferSize);
+					"create new buffer for %s.%s.%s.%s with size %d", id.first.c_str(), id.second.c_str(), info.locationCode.c_str(), info.streamCode.c_str(), _bufferSize);
 
-			station->push_back(sensor);
+			_stations[stationHandle].sensors.push_back(sensor);
+			if ( info.located )
+				indexSensor(sensor);
 		}
 
 		int component;
@@ -181,21 +551,27 @@ bool Timeline::feed(const DataModel::VS::Envelope *env) {
 		else {
 			SEISCOMP_WARNING(
 					"ignoring unknown envelope channel (%s)", cha->name().c_str());
+			++_statistics.unknownChannel;
 			continue;
 		}
 
+		int s = slot(idx);
+		uint8_t &mask = clipMask(sensor)[s];
+
 		for ( size_t j = 0; j < cha->envelopeValueCount(); ++j ) {
 			DataModel::VS::EnvelopeValue *value = cha->envelopeValue(j);
-			Envelope &e = sensor->buffer[idx].envelopes[component];
 
 			if ( value->type() == "acc" ) {
-				e.values[Acceleration] = value->value();
+				column(sensor, component, Acceleration)[s] = value->value();
 				++cnt;
 			} else if ( value->type() == "vel" ) {
-				e.values[Velocity] = value->value();
+				column(sensor, component, Velocity)[s] = value->value();
+				if ( component == Z && value->value() >= 0 )
+					_sensors[sensor].lastVerticalVelocity = std::max(
+						_sensors[sensor].lastVerticalVelocity, _origin + idx);
 				++cnt;
 			} else if ( value->type() == "disp" ) {
-				e.values[Displacement] = value->value();
+				column(sensor, component, Displacement)[s] = value->value();
 				++cnt;
 			} else
 				SEISCOMP_WARNING(
@@ -203,25 +579,23 @@ bool Timeline::feed(const DataModel::VS::Envelope *env) {
 
 			try {
 				if ( value->quality() == DataModel::VS::clipped ) {
-					sensor->buffer[idx].envelopes[component].clipped = true;
+					mask |= 1 << component;
 				}
 			} catch ( ... ) {
 			}
 		}
 
 		// Update H if possible
-		Envelope &EH = sensor->buffer[idx].envelopes[H];
-		Envelope &EH1 = sensor->buffer[idx].envelopes[H1];
-		Envelope &EH2 = sensor->buffer[idx].envelopes[H2];
-
 		for ( int j = 0; j < ValueTypeQuantity; ++j ) {
-			if ( EH1.values[j] >= 0 && EH2.values[j] >= 0 )
-				EH.values[j] = (float) sqrt(
-						EH1.values[j] * EH1.values[j]
-								+ EH2.values[j] * EH2.values[j]);
+			float h1 = column(sensor, H1, j)[s];
+			float h2 = column(sensor, H2, j)[s];
+			if ( h1 >= 0 && h2 >= 0 )
+				column(sensor, H, j)[s] = (float) sqrt(h1 * h1 + h2 * h2);
 		}
-		if ( EH1.clipped || EH2.clipped )
-			EH.clipped = true;
+		if ( mask & ((1 << H1) | (1 << H2)) )
+			mask |= 1 << H;
+
+		updateBlock(sensor, s / BlockSize);
 	}
 
 	return cnt > 0;
@@ -231,10 +605,18 @@ ReturnCode Timeline::maxmimum(const StationID &id, const Core::Time &start,
 		const Core::Time &end, const Core::Time &pick, Envelope &max_Z,
 		Core::Time &timeVertical, Envelope &max_H, Core::Time &timeHorizontal,
 		std::string &locationCode, std::string &channelCode) const {
+	return maxmimum(station(id), start, end, pick, max_Z, timeVertical,
+	                max_H, timeHorizontal, locationCode, channelCode);
+}
+
+ReturnCode Timeline::maxmimum(StationHandle handle, const Core::Time &start,
+		const Core::Time &end, const Core::Time &pick, Envelope &max_Z,
+		Core::Time &timeVertical, Envelope &max_H, Core::Time &timeHorizontal,
+		std::string &locationCode, std::string &channelCode) const {
 		int start_idx = (int) (start - _referenceTime).seconds() + _backSlots;
 		int end_idx = (int) (end - _referenceTime).seconds() + _backSlots;
 		int pick_idx = (int) (pick - _referenceTime).seconds() + _backSlots;
-		int bufferSize = _headSlots + _backSlots;
+		int bufferSize = _bufferSize;
 
 	// Check if time window is completely outside the buffer
 	if ( start_idx >= bufferSize )
@@ -256,18 +638,14 @@ ReturnCode Timeline::maxmimum(const StationID &id, const Core::Time &start,
 		return index_error;
 
 	// Look up station
-	Stations::const_iterator it;
-	SensorBuffersPtr station;
-
-	it = _stations.find(id);
-	if ( it == _stations.end() )
+	if ( handle < 0 || handle >= (int)_stations.size() )
 		return no_data;
 
-	station = it->second;
+	const Station &station = _stations[handle];
+	const StationID &id = station.id;
 
 	// Find sensors (either SM or VEL or both)
-	SensorBuffers::iterator sit;
-	SensorBufferPtr sensorACC, sensorVEL;
+	SensorHandle sensorACC = -1, sensorVEL = -1;
 	int max_Zidx[] = {-1, -1, -1};
 	int max_Hidx[] = {-1, -1, -1};
 	int max_idx = -1;
@@ -278,50 +656,41 @@ ReturnCode Timeline::maxmimum(const StationID &id, const Core::Time &start,
 	// each is taken.
 	// TODO: Maybe a better decision is to take the highest values of each
 	//       type.
-	for ( sit = station->begin(); sit != station->end(); ++sit ) {
-		SensorBufferPtr sensor = *sit;
-		if ( sensor->sensorUnit
+	for ( size_t s = 0; s < station.sensors.size(); ++s ) {
+		const Sensor &sensor = _sensors[station.sensors[s]];
+		if ( sensor.sensorUnit
 				== Processing::WaveformProcessor::MeterPerSecondSquared )
-			sensorACC = sensor;
-		else if ( sensor->sensorUnit
+			sensorACC = station.sensors[s];
+		else if ( sensor.sensorUnit
 				== Processing::WaveformProcessor::MeterPerSecond )
-			sensorVEL = sensor;
+			sensorVEL = station.sensors[s];
 	}
 
-	if ( sensorVEL ) {
-		for ( int i = start_idx; i <= end_idx; ++i ) {
-			const Cell &cell = sensorVEL->buffer[i];
-			// Ignore clipped values
-			if ( cell.envelopes[Z].clipped || cell.envelopes[H].clipped )
-				continue;
+	Window window(_head, _bufferSize, BlockSize, start_idx, end_idx);
 
-			// Check vertical values
-			for( int ci = 0; ci< ValueTypeQuantity; ++ci ){
-				 if ( cell.envelopes[Z].values[ci] >= 0){
-					 latest_entry = i;
-					 if ( cell.envelopes[Z].values[ci] > max_Z.values[ci] ) {
-						 max_Z.values[ci] = cell.envelopes[Z].values[ci];
-						 max_Zidx[ci] = i;
-						 if ( i > max_idx )
-							 max_idx = i;
-						 if ( i < min_idx )
-							 min_idx = i;
-					 }
-				 }
-			}
+	if ( sensorVEL >= 0 ) {
+		const uint8_t *mask = clipMask(sensorVEL);
 
-			// Check horizontal values
-			for( int ci = 0; ci< ValueTypeQuantity; ++ci ){
-				if ( cell.envelopes[H].values[ci] >= 0 && cell.envelopes[H].values[ci] > max_H.values[ci] ) {
-					max_H.values[ci] = cell.envelopes[H].values[ci];
-					max_Hidx[ci] = i;
-					if ( i > max_idx )
-						max_idx = i;
-					if ( i < min_idx )
-						min_idx = i;
-				}
-			}
+		// Check vertical and horizontal values. Clipped values are ignored.
+		for ( int ci = 0; ci < ValueTypeQuantity; ++ci ) {
+			Column z = { column(sensorVEL, Z, ci), blockMax(sensorVEL, Z, ci) };
+			Column h = { column(sensorVEL, H, ci), blockMax(sensorVEL, H, ci) };
+			updateMaximum(z, mask, window, max_Z.values[ci], max_Zidx[ci],
+			              min_idx, max_idx);
+			updateMaximum(h, mask, window, max_H.values[ci], max_Hidx[ci],
+			              min_idx, max_idx);
 		}
+
+		// Find the latest unclipped vertical entry
+		Column z[ValueTypeQuantity];
+		for ( int ci = 0; ci < ValueTypeQuantity; ++ci ) {
+			z[ci].values = column(sensorVEL, Z, ci);
+			z[ci].blockMax = blockMax(sensorVEL, Z, ci);
+		}
+		int latest = latestEntry(z, mask, window);
+		if ( latest >= 0 )
+			latest_entry = latest;
+
 		// check that the time between the pick and the latest envelope entry
 		// in the buffer is at least 1 s
 		if ( latest_entry - pick_idx < 1 )
@@ -330,40 +699,37 @@ ReturnCode Timeline::maxmimum(const StationID &id, const Core::Time &start,
 		SEISCOMP_DEBUG("max_idx: %d; min_idx: %d", max_idx, min_idx);
 		if ( max_idx < 0 ) {
 			SEISCOMP_DEBUG(
-					"No maximum found for %s.%s.%s.", id.first.c_str(), id.second.c_str(), sensorVEL->streamCode.c_str());
+					"No maximum found for %s.%s.%s.", id.first.c_str(), id.second.c_str(), _sensors[sensorVEL].streamCode.c_str());
 		}
 
 		// If clipped data is found in the last '_clipTimeout' seconds
 		// check whether there is a co-located strong motion sensor.
 		// If not, do not use this sensor.
 		int clipcheck_idx = max(min_idx - _clipTimeout, 0);
-		for ( int i = clipcheck_idx; i <= max_idx; ++i ) {
-			const Cell &cell = sensorVEL->buffer[i];
-			if ( cell.envelopes[Z].clipped || cell.envelopes[H].clipped ) {
+		Window clipWindow(_head, _bufferSize, BlockSize, clipcheck_idx, max_idx);
+		if ( anyClipped(mask, blockClipped(sensorVEL), clipWindow) ) {
+			SEISCOMP_DEBUG(
+					"Record %s.%s.%s has been clipped!", id.first.c_str(), id.second.c_str(), _sensors[sensorVEL].streamCode.c_str());
+			if ( sensorACC >= 0 ) {
 				SEISCOMP_DEBUG(
-						"Record %s.%s.%s has been clipped!", id.first.c_str(), id.second.c_str(), sensorVEL->streamCode.c_str());
-				if ( sensorACC ) {
-					SEISCOMP_DEBUG(
-							"Using %s.%s.%s instead.", id.first.c_str(), id.second.c_str(), sensorACC->streamCode.c_str());
-					// Reset index and go to strong motion sensor
-					min_idx = end_idx;
-					max_idx = -1;
-					for ( int i = 0; i < ValueTypeQuantity; ++i ) {
-						max_Z.values[i] = -1;
-						max_H.values[i] = -1;
-					}
-					break;
-				} else {
-					return clipped_data;
+						"Using %s.%s.%s instead.", id.first.c_str(), id.second.c_str(), _sensors[sensorACC].streamCode.c_str());
+				// Reset index and go to strong motion sensor
+				min_idx = end_idx;
+				max_idx = -1;
+				for ( int i = 0; i < ValueTypeQuantity; ++i ) {
+					max_Z.values[i] = -1;
+					max_H.values[i] = -1;
 				}
+			} else {
+				return clipped_data;
 			}
 		}
 		SEISCOMP_DEBUG("Number of maxima not found on Z component: %d", (int)std::count(max_Zidx,max_Zidx+ValueTypeQuantity,-1));
 		SEISCOMP_DEBUG("Number of maxima not found on H component: %d", (int)std::count(max_Hidx,max_Hidx+ValueTypeQuantity,-1));
 		if ( std::count(max_Zidx,max_Zidx+ValueTypeQuantity,-1) == 0 &&
 			std::count(max_Hidx,max_Hidx+ValueTypeQuantity,-1) == 0 ) {
-			locationCode = sensorVEL->locationCode;
-			channelCode = sensorVEL->streamCode;
+			locationCode = _sensors[sensorVEL].locationCode;
+			channelCode = _sensors[sensorVEL].streamCode;
 			timeVertical = _referenceTime
 					+ Core::TimeSpan(max_idx - _backSlots, 0);
 			timeHorizontal = _referenceTime
@@ -372,63 +738,39 @@ ReturnCode Timeline::maxmimum(const StationID &id, const Core::Time &start,
 		}
 	}
 
-	if ( sensorACC ) {
-		for ( int i = start_idx; i <= end_idx; ++i ) {
-			const Cell &cell = sensorACC->buffer[i];
-			// Ignore clipped values
-			if ( cell.envelopes[Z].clipped || cell.envelopes[H].clipped ) {
-				SEISCOMP_DEBUG(
-						"Record %s.%s.%s has been clipped!", id.first.c_str(), id.second.c_str(), sensorACC->streamCode.c_str());
-				continue;
-			}
-
-			// Check vertical values
-			for(int ci = 0; ci< ValueTypeQuantity; ++ci){
-				if ( cell.envelopes[Z].values[ci] >= 0 && cell.envelopes[Z].values[ci] > max_Z.values[ci] ) {
-					max_Z.values[ci] = cell.envelopes[Z].values[ci];
-					max_Zidx[ci] = i;
-					if ( i > max_idx )
-						max_idx = i;
-					if ( i < min_idx )
-						min_idx = i;
-				}
-			}
-
-			// Check horizontal values
-			for(int ci = 0; ci< ValueTypeQuantity; ++ci){
-				if ( cell.envelopes[H].values[ci] >= 0 && cell.envelopes[H].values[ci] > max_H.values[ci] ) {
-					max_H.values[ci] = cell.envelopes[H].values[ci];
-					max_Hidx[ci] = i;
-					if ( i > max_idx )
-						max_idx = i;
-					if ( i < min_idx )
-						min_idx = i;
-				}
-			}
+	if ( sensorACC >= 0 ) {
+		const uint8_t *mask = clipMask(sensorACC);
+
+		// Check vertical and horizontal values. Clipped values are ignored.
+		for ( int ci = 0; ci < ValueTypeQuantity; ++ci ) {
+			Column z = { column(sensorACC, Z, ci), blockMax(sensorACC, Z, ci) };
+			Column h = { column(sensorACC, H, ci), blockMax(sensorACC, H, ci) };
+			updateMaximum(z, mask, window, max_Z.values[ci], max_Zidx[ci],
+			              min_idx, max_idx);
+			updateMaximum(h, mask, window, max_H.values[ci], max_Hidx[ci],
+			              min_idx, max_idx);
 		}
 
 		if ( max_idx < 0 ) {
 			SEISCOMP_DEBUG(
-					"No maximum found for %s.%s.%s.", id.first.c_str(), id.second.c_str(), sensorACC->streamCode.c_str());
+					"No maximum found for %s.%s.%s.", id.first.c_str(), id.second.c_str(), _sensors[sensorACC].streamCode.c_str());
 			return no_data;
 		}
 
 		// If clipped data is found in the last '_clipTimeout' seconds
 		// do not use this sensor.
 		int clipcheck_idx = max(min_idx - _clipTimeout, 0);
-		for ( int i = clipcheck_idx; i <= max_idx; ++i ) {
-			const Cell &cell = sensorACC->buffer[i];
-			if ( cell.envelopes[Z].clipped || cell.envelopes[H].clipped ) {
-				SEISCOMP_DEBUG(
-						"Record %s.%s.%s has been clipped!", id.first.c_str(), id.second.c_str(), sensorACC->streamCode.c_str());
-				return clipped_data;
-			}
+		Window clipWindow(_head, _bufferSize, BlockSize, clipcheck_idx, max_idx);
+		if ( anyClipped(mask, blockClipped(sensorACC), clipWindow) ) {
+			SEISCOMP_DEBUG(
+					"Record %s.%s.%s has been clipped!", id.first.c_str(), id.second.c_str(), _sensors[sensorACC].streamCode.c_str());
+			return clipped_data;
 		}
 
 		if ( std::count(max_Zidx,max_Zidx+ValueTypeQuantity,-1) == 0 &&
 			std::count(max_Hidx,max_Hidx+ValueTypeQuantity,-1) == 0 ) {
-			locationCode = sensorACC->locationCode;
-			channelCode = sensorACC->streamCode;
+			locationCode = _sensors[sensorACC].locationCode;
+			channelCode = _sensors[sensorACC].streamCode;
 			timeVertical = _referenceTime
 					+ Core::TimeSpan(max_idx - _backSlots, 0);
 			timeHorizontal = _referenceTime
@@ -440,83 +782,122 @@ ReturnCode Timeline::maxmimum(const StationID &id, const Core::Time &start,
 	return undefined_problem;
 }
 
+void Timeline::indexSensor(SensorHandle sensor) {
+	const Sensor &info = _sensors[sensor];
+	int latCell = gridCell(info.latitude + 90, 180);
+	int lonCell = gridCell(normalizedLongitude(info.longitude) + 180, 360);
+	_sensorGrid[latCell * 360 + lonCell].push_back(sensor);
+}
+
+bool Timeline::hasVerticalVelocity(SensorHandle sensor, int first, int last) const {
+	// The latest vertical velocity value is an upper bound for all values
+	// in the buffer. If it is older than the window there is nothing to
+	// find and if it is inside the window it is usually still there.
+	int64_t latest = _sensors[sensor].lastVerticalVelocity;
+	if ( latest < _origin + first )
+		return false;
+
+	const float *zv = column(sensor, Z, Velocity);
+	if ( latest <= _origin + last && zv[slot(latest - _origin)] >= 0 )
+		return true;
+
+	// The latest value is ahead of the window or has been overwritten
+	Window window(_head, _bufferSize, BlockSize, first, last);
+	for ( int r = 0; r < window.count; ++r ) {
+		const Window::Range &range = window.ranges[r];
+		for ( int i = 0; i < range.length; ++i ) {
+			if ( zv[range.offset + i] >= 0 )
+				return true;
+		}
+	}
+
+	return false;
+}
+
 ReturnCode Timeline::pollbuffer(double epiclat, double epiclon, double dthresh,
 		int &stationcount) const {
 	int start_idx, end_idx;
 	int cnt = 0;
-	bool found;
-	string locationCode;
 	double distdg, azi1, azi2;
 	StationList stationsCounted;
 
-	// Look up station
-	Client::Inventory *inv = Client::Inventory::Instance();
-
 	// check whether data has arrived within the last 30 s
 	start_idx = _backSlots - 30;
 	end_idx = _backSlots;
 	// Clip start and end indices
 	if ( start_idx < 0 )
 		start_idx = 0;
+	if ( end_idx >= _bufferSize )
+		end_idx = _bufferSize - 1;
+
+	// Collect the stations with at least one sensor in the grid cells
+	// that cover the circle around the epicenter. A small margin accounts
+	// for rounding and the cell boundaries.
+	const double margin = 0.1;
+	std::vector<StationHandle> candidates;
+	int latFirst = gridCell(epiclat - dthresh - margin + 90, 180);
+	int latLast = gridCell(epiclat + dthresh + margin + 90, 180);
+	int lonFirst = 0, lonLast = 359;
+
+	if ( fabs(epiclat) + dthresh + margin < 90 ) {
+		double s = sin(dthresh * M_PI / 180) / cos(epiclat * M_PI / 180);
+		double halfWidth = s < 1 ? asin(s) * 180 / M_PI + margin : 180;
+		if ( halfWidth < 180 ) {
+			double lon = normalizedLongitude(epiclon) + 180;
+			lonFirst = (int)floor(lon - halfWidth);
+			lonLast = (int)floor(lon + halfWidth);
+		}
+	}
+
+	for ( int lat = latFirst; lat <= latLast; ++lat ) {
+		for ( int lon = lonFirst; lon <= lonLast; ) {
+			// Longitude cells wrap around the dateline
+			int cell = ((lon % 360) + 360) % 360;
+			int last = std::min(lonLast, lon + 359 - cell);
+			SensorGrid::const_iterator it = _sensorGrid.lower_bound(lat * 360 + cell);
+			SensorGrid::const_iterator end = _sensorGrid.upper_bound(lat * 360 + cell + last - lon);
+			for ( ; it != end; ++it ) {
+				for ( size_t s = 0; s < it->second.size(); ++s )
+					candidates.push_back(_sensors[it->second[s]].station);
+			}
+			lon = last + 1;
+		}
+	}
 
-	Stations::const_iterator it;
-	SensorBuffersPtr station;
-	SensorBuffers::const_iterator sit;
-	for ( it = _stations.begin(); it != _stations.end(); ++it ) {
-		station = it->second;
-		found = false;
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()),
+	                 candidates.end());
+
+	for ( size_t c = 0; c < candidates.size(); ++c ) {
+		const Station &station = _stations[candidates[c]];
 
 		// Check whether waveform data has arrived on the vertical
 		// component of either the velocity or the acceleration sensor
-		SensorBufferPtr sensorACC, sensorVEL;
-		for ( sit = station->begin(); sit != station->end(); ++sit ) {
-			SensorBufferPtr sensor = *sit;
-			if ( sensor->sensorUnit
+		SensorHandle sensorACC = -1, sensorVEL = -1, found = -1;
+		for ( size_t s = 0; s < station.sensors.size(); ++s ) {
+			const Sensor &sensor = _sensors[station.sensors[s]];
+			if ( sensor.sensorUnit
 					== Processing::WaveformProcessor::MeterPerSecondSquared )
-				sensorACC = sensor;
-			else if ( sensor->sensorUnit
+				sensorACC = station.sensors[s];
+			else if ( sensor.sensorUnit
 					== Processing::WaveformProcessor::MeterPerSecond )
-				sensorVEL = sensor;
+				sensorVEL = station.sensors[s];
 		}
 
-		if ( sensorVEL ) {
-			for ( int i = start_idx; i <= end_idx; ++i ) {
-				const Cell &cell = sensorVEL->buffer[i];
-				if ( cell.envelopes[Z].values[Velocity] >= 0){
-					found = true;
-					locationCode = sensorVEL->locationCode;
-					break;
-				}
-			}
-		}
+		if ( sensorVEL >= 0 && hasVerticalVelocity(sensorVEL, start_idx, end_idx) )
+			found = sensorVEL;
+		else if ( sensorACC >= 0 && hasVerticalVelocity(sensorACC, start_idx, end_idx) )
+			found = sensorACC;
 
-		if ( sensorACC && !found ) {
-			for ( int i = start_idx; i <= end_idx; ++i ) {
-				const Cell &cell = sensorACC->buffer[i];
-				if ( cell.envelopes[Z].values[Velocity] >= 0){
-					found = true;
-					locationCode = sensorACC->locationCode;
-					break;
-				}
-			}
-		}
-
-		if(!found)
+		if ( found < 0 || !_sensors[found].located )
 			continue;
 
 		// check whether sensor is within the distance threshold
-		DataModel::SensorLocation *loc;
-		loc = inv->getSensorLocation(it->first.first, it->first.second, locationCode, _referenceTime);
-		if ( loc == NULL ) {
-			SEISCOMP_WARNING(
-					"%s.%s.%s: sensor location not in inventory: ignoring", it->first.first.c_str(), it->first.second.c_str(), locationCode.c_str());
-			continue;
-		}
-		Math::Geo::delazi(epiclat, epiclon, loc->latitude(), loc->longitude(),
-						&distdg, &azi1, &azi2);
+		Math::Geo::delazi(epiclat, epiclon, _sensors[found].latitude,
+		                  _sensors[found].longitude, &distdg, &azi1, &azi2);
 		if ( distdg < dthresh ){
 			cnt++;
-			stationsCounted.insert(it->first);
+			stationsCounted.insert(station.id);
 		}
 	}
 	string resultstr;
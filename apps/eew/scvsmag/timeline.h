@@ -25,8 +25,9 @@
 #include <seiscomp/datamodel/vs/vs_package.h>
 #include <seiscomp/math/geo.h>
 #include <set>
-
-#include "circular.h"
+#include <vector>
+#include <map>
+#include <stdint.h>
 
 namespace Seiscomp {
 
@@ -83,36 +84,49 @@ struct Envelope {
 	bool clipped;
 };
 
-struct Cell {
-	Cell() {}
-	Envelope envelopes[ComponentQuantity];
-};
-
-typedef circular_buffer<Cell> Row; // see circular.h by Pete Goodliffe 
-
-struct SensorBuffer {
-	SensorBuffer(size_t capacity) :
-			buffer(capacity) {
-	}
-
-	typedef Processing::WaveformProcessor::SignalUnit SignalUnit;
-	Row buffer;
-	SignalUnit sensorUnit;
-	std::string locationCode;
-	std::string streamCode; // Without component code (e.g. HH)
-};
-
-typedef std::shared_ptr<SensorBuffer> SensorBufferPtr;
-typedef std::list<SensorBufferPtr> SensorBuffers;
-typedef std::shared_ptr<SensorBuffers> SensorBuffersPtr;
-
 class Timeline {
 public:
 	//! Pair of network and station code
 	typedef std::pair<std::string, std::string> StationID;
-	typedef std::map<StationID, SensorBuffersPtr> Stations;
 	typedef std::set<StationID> StationList;
 
+	//! Index of a station in the timeline, -1 if unknown
+	typedef int StationHandle;
+	//! Index of a sensor (location and stream code) in the envelope arena
+	typedef int SensorHandle;
+
+	typedef Processing::WaveformProcessor::SignalUnit SignalUnit;
+
+	struct Sensor {
+		SignalUnit sensorUnit;
+		std::string locationCode;
+		std::string streamCode; // Without component code (e.g. HH)
+		StationHandle station;
+		// Coordinates of the sensor location taken from the inventory when
+		// the first envelope of the sensor arrived
+		bool located;
+		double latitude;
+		double longitude;
+		// Absolute slot of the latest vertical velocity envelope value
+		int64_t lastVerticalVelocity;
+	};
+
+	struct Station {
+		StationID id;
+		std::vector<SensorHandle> sensors;
+	};
+
+	//! Number of envelope channels that were not stored, per reason
+	struct Statistics {
+		Statistics()
+		: tooOld(0), tooNew(0), unknownStream(0), unknownChannel(0) {}
+
+		size_t tooOld;
+		size_t tooNew;
+		size_t unknownStream;
+		size_t unknownChannel;
+	};
+
 	/**
 	 Initializes the timeline and sets the number of slots
 	 in the past to "past" and the number of slots in the future
@@ -148,6 +162,12 @@ public:
 	 */
 	bool feed(const DataModel::VS::Envelope *env);
 
+	/**
+	 Returns the handle of a station which stays valid for the lifetime
+	 of the timeline or -1 if no envelopes have been received for it yet.
+	 */
+	StationHandle station(const StationID &id) const;
+
 	/**
 	 Returns the maximum vertical and maximum horizontal envelope
 	 of a station id between start and end.
@@ -164,6 +184,22 @@ public:
 			Core::Time &timeHorizontal, std::string &locationCode,
 			std::string &channelCode) const;
 
+	//! Same as above but with a station handle instead of a station id
+	ReturnCode maxmimum(StationHandle handle, const Core::Time &start,
+			const Core::Time &end, const Core::Time &pick, Envelope &vertical,
+			Core::Time &timeVertical, Envelope &horizontal,
+			Core::Time &timeHorizontal, std::string &locationCode,
+			std::string &channelCode) const;
+
+	/**
+	 Returns whether the time window between start and end lies completely
+	 inside the buffer.
+	 */
+	bool covers(const Core::Time &start, const Core::Time &end) const;
+
+	//! Returns the number of sensors of a station
+	int sensorCount(const StationID &id) const;
+
 	/**
 	 Checks for which stations within a given distance of the epicenter data
 	 is available.
@@ -171,17 +207,119 @@ public:
 	ReturnCode pollbuffer(double epiclat, double epiclon, double dthresh,
 			int &stationcount) const;
 
+	//! Returns the counters of dropped envelope channels since init().
+	const Statistics &statistics() const {
+		return _statistics;
+	}
+
 	/**
 	 Returns the number of envelope streams in the buffer.
 	 @return int The number of envelope streams.
 	 */
-	int StreamCount();
+	int StreamCount() const;
+
 private:
+	enum {
+		// One column per component and value type
+		ColumnQuantity = ComponentQuantity * ValueTypeQuantity,
+		// Columns that are searched for maxima (Z and H)
+		SearchColumnQuantity = 2 * ValueTypeQuantity,
+		// Number of slots summarized by one block maximum
+		BlockSize = 64
+	};
+
+	SensorHandle addSensor(const Sensor &sensor);
+
+	//! Recomputes the block maxima and the clip count of a block
+	void updateBlock(SensorHandle sensor, int block);
+
+	//! Adds a located sensor to the station grid
+	void indexSensor(SensorHandle sensor);
+
+	//! Checks whether a vertical velocity value exists between the
+	//! logical buffer indices first and last
+	bool hasVerticalVelocity(SensorHandle sensor, int first, int last) const;
+
+	//! Converts a logical buffer index (0 = oldest slot) into an arena slot
+	int slot(int idx) const {
+		idx += _head;
+		return idx >= _bufferSize ? idx - _bufferSize : idx;
+	}
+
+	float *column(SensorHandle sensor, int component, int valueType) {
+		return &_values[((size_t)sensor * ColumnQuantity
+		                 + component * ValueTypeQuantity + valueType) * _bufferSize];
+	}
+
+	const float *column(SensorHandle sensor, int component, int valueType) const {
+		return &_values[((size_t)sensor * ColumnQuantity
+		                 + component * ValueTypeQuantity + valueType) * _bufferSize];
+	}
+
+	uint8_t *clipMask(SensorHandle sensor) {
+		return &_clipMask[(size_t)sensor * _bufferSize];
+	}
+
+	const uint8_t *clipMask(SensorHandle sensor) const {
+		return &_clipMask[(size_t)sensor * _bufferSize];
+	}
+
+	//! Returns the block maxima of a Z or H column
+	float *blockMax(SensorHandle sensor, int component, int valueType) {
+		return &_blockMax[((size_t)sensor * SearchColumnQuantity
+		                   + (component == Z ? 0 : ValueTypeQuantity)
+		                   + valueType) * _blockCount];
+	}
+
+	const float *blockMax(SensorHandle sensor, int component, int valueType) const {
+		return &_blockMax[((size_t)sensor * SearchColumnQuantity
+		                   + (component == Z ? 0 : ValueTypeQuantity)
+		                   + valueType) * _blockCount];
+	}
+
+	const uint16_t *blockClipped(SensorHandle sensor) const {
+		return &_blockClipped[(size_t)sensor * _blockCount];
+	}
+
+private:
+	typedef std::map<StationID, StationHandle> StationIndex;
+	//! Sensors per grid cell of one by one degree. The key of a cell is
+	//! latitude cell * 360 + longitude cell with both cells counted from
+	//! -90 and -180 degrees respectively.
+	typedef std::map<int, std::vector<SensorHandle> > SensorGrid;
+
 	Core::Time _referenceTime;
-	Stations _stations;
+	StationIndex _stationIndex;
+	std::vector<Station> _stations;
+	std::vector<Sensor> _sensors;
+	SensorGrid _sensorGrid;
+
+	// The envelope arena: all sensors share the same ring offset (_head)
+	// and the same buffer size. Each sensor owns ColumnQuantity consecutive
+	// float columns of _bufferSize values and one clip mask column which
+	// holds one bit per component.
+	std::vector<float> _values;
+	std::vector<uint8_t> _clipMask;
+	int _bufferSize;
+	int _head;
+	// Absolute slot number of the oldest slot in the buffer
+	int64_t _origin;
+
+	// Summary of the arena per block of BlockSize slots. Blocks are aligned
+	// to the arena and not to the ring head. For each sensor the maximum
+	// unclipped value of the Z and H columns and the number of slots where
+	// Z or H is clipped are kept. Both are updated whenever a slot changes
+	// so that window queries only need to scan the partial blocks at the
+	// window boundaries.
+	std::vector<float> _blockMax;
+	std::vector<uint16_t> _blockClipped;
+	int _blockCount;
+
 	int _headSlots;
 	int _backSlots;
 	int _clipTimeout;
+
+	Statistics _statistics;
 };
 }
 #endif
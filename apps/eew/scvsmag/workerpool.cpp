@@ -0,0 +1,122 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ ***************************************************************************/
+
+#include "workerpool.h"
+
+namespace Seiscomp {
+
+WorkerPool::WorkerPool()
+: _task(NULL), _count(0), _next(0), _busy(0), _generation(0), _shutdown(false) {}
+
+WorkerPool::~WorkerPool() {
+	stop();
+}
+
+void WorkerPool::start(int threads) {
+	stop();
+
+	_shutdown = false;
+	for ( int i = 1; i < threads; ++i )
+		_threads.push_back(std::thread(&WorkerPool::work, this));
+}
+
+void WorkerPool::stop() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_shutdown = true;
+	}
+	_wakeup.notify_all();
+
+	for ( size_t i = 0; i < _threads.size(); ++i )
+		_threads[i].join();
+	_threads.clear();
+
+	// Workers of the next start() begin with generation 0 and must not
+	// take the generation of the last run() for a new one
+	_generation = 0;
+}
+
+void WorkerPool::run(size_t count, const Task &task) {
+	if ( _threads.empty() || count < 2 ) {
+		for ( size_t i = 0; i < count; ++i )
+			task(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_task = &task;
+		_count = count;
+		_next = 0;
+		_busy = _threads.size();
+		++_generation;
+	}
+	_wakeup.notify_all();
+
+	process();
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	_finished.wait(lock, [this] { return _busy == 0; });
+	_task = NULL;
+
+	// Pass the first exception of any task to the caller as if the tasks
+	// were run sequentially
+	if ( _error ) {
+		std::exception_ptr error = _error;
+		_error = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+void WorkerPool::process() {
+	size_t i;
+	while ( (i = _next++) < _count ) {
+		try {
+			(*_task)(i);
+		}
+		catch ( ... ) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			if ( !_error )
+				_error = std::current_exception();
+		}
+	}
+}
+
+void WorkerPool::work() {
+	unsigned int generation = 0;
+
+	while ( true ) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wakeup.wait(lock, [this, generation] {
+				return _shutdown || _generation != generation;
+			});
+			if ( _shutdown )
+				return;
+			generation = _generation;
+		}
+
+		process();
+
+		bool last;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			last = --_busy == 0;
+		}
+		if ( last )
+			_finished.notify_one();
+	}
+}
+
+}
@@ -0,0 +1,87 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ ***************************************************************************/
+
+#ifndef __SEISCOMP_APPLICATIONS_SCVSMAG_WORKERPOOL_H__
+#define __SEISCOMP_APPLICATIONS_SCVSMAG_WORKERPOOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Seiscomp {
+
+/**
+ \brief A fixed set of threads that execute indexed tasks.
+
+ run() distributes the indices of a task over the worker threads and the
+ calling thread and returns when all of them have been processed. The
+ threads are kept alive between calls.
+ */
+class WorkerPool {
+public:
+	typedef std::function<void(size_t)> Task;
+
+	WorkerPool();
+	~WorkerPool();
+
+	/**
+	 Starts the worker threads. Together with the thread calling run()
+	 up to threads tasks are executed concurrently.
+	 @param threads Number of concurrent tasks, values below 2 do not
+	 start any thread
+	 */
+	void start(int threads);
+
+	//! Stops and joins all worker threads.
+	void stop();
+
+	//! Returns the number of concurrent tasks.
+	int concurrency() const {
+		return _threads.size() + 1;
+	}
+
+	/**
+	 Calls task(i) for all i in [0,count) and blocks until all calls
+	 returned. The order of the calls is undefined. If a task throws,
+	 the remaining indices are still processed and the first exception
+	 is rethrown afterwards.
+	 */
+	void run(size_t count, const Task &task);
+
+private:
+	void work();
+	void process();
+
+	std::vector<std::thread> _threads;
+	std::mutex _mutex;
+	std::condition_variable _wakeup;
+	std::condition_variable _finished;
+
+	const Task *_task;
+	size_t _count;
+	std::atomic<size_t> _next;
+	size_t _busy;
+	unsigned int _generation;
+	bool _shutdown;
+	// First exception thrown by a task of the current run
+	std::exception_ptr _error;
+};
+
+}
+
+#endif
@@ -77,7 +77,7 @@ class SC_LIBEEWAMPS_API BaseProcessor : public WaveformProcessor {
 		SignalUnit signalUnit() const;
 
 		void setWaveformID(const DataModel::WaveformStreamID &id);
-		DataModel::WaveformStreamID waveformID() const;
+		const DataModel::WaveformStreamID &waveformID() const;
 
 		const std::string &streamID() const;
 
@@ -97,7 +97,7 @@ inline BaseProcessor::SignalUnit BaseProcessor::signalUnit() const {
 	return _unit;
 }
 
-inline DataModel::WaveformStreamID BaseProcessor::waveformID() const {
+inline const DataModel::WaveformStreamID &BaseProcessor::waveformID() const {
 	return _waveformID;
 }
 
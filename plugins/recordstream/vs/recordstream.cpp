@@ -22,6 +22,11 @@
 #include <seiscomp/core/plugin.h>
 #include "recordstream.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+
 
 using namespace std;
 using namespace Seiscomp;
@@ -35,17 +40,89 @@ REGISTER_RECORDSTREAM(VSConnection, "vs");
 ADD_SC_PLUGIN(
 	"VS (Virtual Seismologist) record stream interface to acquire envelope values",
 	"Jan Becker, gempa GmbH",
-	0, 3, 0
+	0, 4, 0
 )
 // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
 
 
 
 
+namespace {
+
+
+// Memory blocks of deleted records. Records are usually deleted by the
+// consumer which might run in another thread than the connection. The pool
+// is never destroyed because records might outlive static destruction.
+std::mutex recordPoolMutex;
+std::vector<void*> *recordPool = new std::vector<void*>;
+const size_t MaxRecordPoolSize = 4096;
+// Default maximum number of queued messages. sceewenv sends one message per
+// stream and envelope interval, so this covers minutes of envelopes of a
+// large network.
+const size_t DefaultQueueSize = 100000;
+// Interval of the receive queue reports, shorter if the consumer falls
+// behind
+const double ReportInterval = 60;
+const double LateReportInterval = 10;
+// Messages which waited longer in the receive queue raise a warning
+const double MaxMessageAge = 5;
+
+
+}
+// <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+
+
+
+
+// >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+void *VSRecord::operator new(size_t size) {
+	if ( size == sizeof(VSRecord) ) {
+		std::lock_guard<std::mutex> lock(recordPoolMutex);
+		if ( !recordPool->empty() ) {
+			void *ptr = recordPool->back();
+			recordPool->pop_back();
+			return ptr;
+		}
+	}
+
+	return ::operator new(size);
+}
+// <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+
+
+
+
+// >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+void VSRecord::operator delete(void *ptr, size_t size) {
+	if ( ptr == NULL ) return;
+
+	if ( size == sizeof(VSRecord) ) {
+		std::lock_guard<std::mutex> lock(recordPoolMutex);
+		if ( recordPool->size() < MaxRecordPoolSize ) {
+			recordPool->push_back(ptr);
+			return;
+		}
+	}
+
+	::operator delete(ptr);
+}
+// <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+
+
+
+
 // >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 VSConnection::VSConnection()
 : RecordStream()
-, _queue(NULL) {}
+, _closeRequested(false)
+, _maxSamples(1)
+, _queue(NULL)
+, _queueTail(NULL)
+, _receiving(false)
+, _maxMessages(DefaultQueueSize)
+, _dropOldest(false)
+, _droppedMessages(0)
+, _reportedDrops(0) {}
 // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
 
 
@@ -53,11 +130,8 @@ VSConnection::VSConnection()
 
 // >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 VSConnection::~VSConnection() {
-	while ( _queue != NULL ) {
-		VSRecord *rec = _queue;
-		_queue = _queue->next;
-		delete rec;
-	}
+	stopReceiver();
+	clearQueue();
 }
 // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
 
@@ -69,11 +143,60 @@ bool VSConnection::setSource(const string &source) {
 	close();
 	_group = "VS";
 	_host = "localhost/production";
+	_maxSamples = 1;
+	_maxMessages = DefaultQueueSize;
+	_dropOldest = false;
 
 	size_t pos = source.rfind('#');
 	if ( pos != string::npos ) {
 		_host = source.substr(0, pos);
 		_group = source.substr(pos+1);
+
+		// Options follow the group, e.g. #VS?samples=10&queueSize=1000&dropOldest
+		pos = _group.find('?');
+		if ( pos != string::npos ) {
+			vector<string> options;
+			Core::split(options, _group.substr(pos+1).c_str(), "&");
+			_group.erase(pos);
+
+			for ( size_t i = 0; i < options.size(); ++i ) {
+				string name = options[i], value;
+				size_t eq = name.find('=');
+				if ( eq != string::npos ) {
+					value = name.substr(eq+1);
+					name.erase(eq);
+				}
+
+				if ( name == "samples" ) {
+					int samples;
+					if ( !Core::fromString(samples, value) || samples < 1 ) {
+						SEISCOMP_ERROR("Invalid number of samples: %s", value.c_str());
+						return false;
+					}
+					_maxSamples = samples;
+				}
+				else if ( name == "queueSize" ) {
+					int queueSize;
+					if ( !Core::fromString(queueSize, value) || queueSize < 1 ) {
+						SEISCOMP_ERROR("Invalid queue size: %s", value.c_str());
+						return false;
+					}
+					_maxMessages = queueSize;
+				}
+				else if ( name == "dropOldest" ) {
+					bool dropOldest = true;
+					if ( !value.empty() && !Core::fromString(dropOldest, value) ) {
+						SEISCOMP_ERROR("Invalid value for dropOldest: %s", value.c_str());
+						return false;
+					}
+					_dropOldest = dropOldest;
+				}
+				else {
+					SEISCOMP_ERROR("Unknown option: %s", name.c_str());
+					return false;
+				}
+			}
+		}
 	}
 
 	return true;
@@ -86,11 +209,7 @@ bool VSConnection::setSource(const string &source) {
 // >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 bool VSConnection::connect() {
 	// Delete all pending records
-	while ( _queue != NULL ) {
-		VSRecord *rec = _queue;
-		_queue = _queue->next;
-		delete rec;
-	}
+	clearQueue();
 
 	if ( _connection ) {
 		SEISCOMP_ERROR("already connected");
@@ -126,12 +245,13 @@ bool VSConnection::connect() {
 
 // >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 bool VSConnection::handle(Seiscomp::DataModel::VS::Envelope *e) {
-	VSRecord *last = NULL;
+	if ( e->timestamp() > _latestTimestamp )
+		_latestTimestamp = e->timestamp();
 
 	for ( size_t i = 0; i < e->envelopeChannelCount(); ++i ) {
 		Seiscomp::DataModel::VS::EnvelopeChannel *cha = e->envelopeChannel(i);
-		cha->name();
-		cha->waveformID();
+		const DataModel::WaveformStreamID &wid = cha->waveformID();
+
 		for ( size_t j = 0; j < cha->envelopeValueCount(); ++j ) {
 			Seiscomp::DataModel::VS::EnvelopeValue *val = cha->envelopeValue(j);
 			char suffix;
@@ -145,29 +265,37 @@ bool VSConnection::handle(Seiscomp::DataModel::VS::Envelope *e) {
 			else
 				continue;
 
-			string chacode = cha->waveformID().channelCode() + suffix;
-			if ( !isRequested(cha->waveformID().networkCode(),
-			                  cha->waveformID().stationCode(),
-			                  cha->waveformID().locationCode(), chacode) )
+			string chacode = wid.channelCode() + suffix;
+			string id = wid.networkCode() + "." + wid.stationCode() + "."
+			          + wid.locationCode() + "." + chacode;
+			if ( !isRequested(id, wid.networkCode(), wid.stationCode(),
+			                  wid.locationCode(), chacode) )
 				continue;
 
-			VSRecord *rec = new VSRecord;
-			float value = (float)val->value();
-
-			rec->setNetworkCode(cha->waveformID().networkCode());
-			rec->setStationCode(cha->waveformID().stationCode());
-			rec->setLocationCode(cha->waveformID().locationCode());
-			rec->setChannelCode(chacode);
+			PendingRecord &pending = _pending[id];
+
+			// Only values which continue the record at one sample per
+			// second are appended
+			if ( !pending.samples.empty()
+			  && e->timestamp() != pending.startTime + TimeSpan((long)pending.samples.size(), 0) )
+				queue(pending);
+
+			if ( pending.samples.empty() ) {
+				if ( pending.net.empty() ) {
+					pending.net = wid.networkCode();
+					pending.sta = wid.stationCode();
+					pending.loc = wid.locationCode();
+					pending.cha = chacode;
+					pending.samples.reserve(_maxSamples);
+				}
 
-			rec->setStartTime(e->timestamp());
-			rec->setSamplingFrequency(1.0);
-			rec->setDataType(Array::FLOAT);
-			rec->setData(1, &value, Array::FLOAT);
+				pending.startTime = e->timestamp();
+			}
 
-			if ( last != NULL ) last->next = rec;
-			else _queue = rec;
+			pending.samples.push_back((float)val->value());
 
-			last = rec;
+			if ( pending.samples.size() >= _maxSamples )
+				queue(pending);
 		}
 	}
 
@@ -181,18 +309,110 @@ bool VSConnection::handle(Seiscomp::DataModel::VS::Envelope *e) {
 // >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 bool VSConnection::addStream(const string &net, const string &sta,
                              const string &loc, const string &cha) {
-	std::pair<Node::List::iterator,bool> itp = _streams.insert(Node(net));
+	// Earlier decisions might change with the new subscription
+	_decisions.clear();
+
+	string id = net + "." + sta + "." + loc + "." + cha;
+	if ( id.find_first_of("*?") == string::npos )
+		return _streams.insert(id).second;
+
+	StreamPattern pattern(net, sta, loc, cha);
+	if ( find(_patterns.begin(), _patterns.end(), pattern) != _patterns.end() )
+		return false;
+
+	_patterns.push_back(pattern);
+	return true;
+}
+// <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+
+
+
+
+// >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+void VSConnection::queue(PendingRecord &pending) {
+	VSRecord *rec = new VSRecord;
+
+	rec->setNetworkCode(pending.net);
+	rec->setStationCode(pending.sta);
+	rec->setLocationCode(pending.loc);
+	rec->setChannelCode(pending.cha);
+
+	rec->setStartTime(pending.startTime);
+	rec->setSamplingFrequency(1.0);
+	rec->setDataType(Array::FLOAT);
+
+	setupRecord(rec);
+
+	// Create the data in the requested type to avoid a copy
+	int count = (int)pending.samples.size();
+	if ( rec->dataType() == Array::DOUBLE ) {
+		DoubleArray *data = new DoubleArray(count);
+		for ( int i = 0; i < count; ++i )
+			(*data)[i] = pending.samples[i];
+		rec->setData(data);
+	}
+	else {
+		rec->setData(count, &pending.samples[0], Array::FLOAT);
+		if ( rec->dataType() != Array::FLOAT )
+			rec->setData(rec->data()->copy(rec->dataType()));
+	}
+
+	pending.samples.clear();
+
+	if ( _queueTail != NULL ) _queueTail->next = rec;
+	else _queue = rec;
+
+	_queueTail = rec;
+}
+// <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+
+
+
+
+// >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+Record *VSConnection::dequeue() {
+	VSRecord *rec = _queue;
+	_queue = _queue->next;
+	if ( _queue == NULL ) _queueTail = NULL;
+	rec->next = NULL;
+	return rec;
+}
+// <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
 
-	Node::List &stas = itp.first->childs;
-	itp = stas.insert(Node(sta));
 
-	Node::List &locs = itp.first->childs;
-	itp = locs.insert(Node(loc));
 
-	Node::List &chas = itp.first->childs;
-	itp = chas.insert(Node(cha));
 
-	return itp.second;
+// >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+void VSConnection::flushPending() {
+	if ( _maxSamples <= 1 || _latestTimestamp <= _flushedTimestamp )
+		return;
+
+	_flushedTimestamp = _latestTimestamp;
+
+	PendingRecords::iterator it;
+	for ( it = _pending.begin(); it != _pending.end(); ++it ) {
+		PendingRecord &pending = it->second;
+		if ( pending.samples.empty() ) continue;
+		if ( pending.startTime + TimeSpan((long)pending.samples.size(), 0) < _latestTimestamp )
+			queue(pending);
+	}
+}
+// <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+
+
+
+
+// >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+void VSConnection::clearQueue() {
+	while ( _queue != NULL ) {
+		VSRecord *rec = _queue;
+		_queue = _queue->next;
+		delete rec;
+	}
+
+	_queueTail = NULL;
+	_pending.clear();
+	_latestTimestamp = _flushedTimestamp = Core::Time();
 }
 // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
 
@@ -230,11 +450,15 @@ bool VSConnection::setEndTime(const TimeType &) {
 
 // >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 bool VSConnection::clear() {
+	stopReceiver();
+
 	if ( _connection ) {
 		_connection->disconnect();
 		_connection = NULL;
 	}
 	_streams.clear();
+	_patterns.clear();
+	_decisions.clear();
 	_closeRequested = false;
 
 	return true;
@@ -245,24 +469,18 @@ bool VSConnection::clear() {
 
 
 // >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
-bool VSConnection::isRequested(const string &net, const string &sta,
+bool VSConnection::isRequested(const string &id,
+                               const string &net, const string &sta,
                                const string &loc, const string &cha) const {
-	Node::List::iterator it = Node::findMatch(_streams, net);
-	if ( it == _streams.end() ) return false;
-
-	const Node::List &stas = it->childs;
-	it = Node::findMatch(stas, sta);
-	if ( it == stas.end() ) return false;
+	Decisions::const_iterator it = _decisions.find(id);
+	if ( it != _decisions.end() ) return it->second;
 
-	const Node::List &locs = it->childs;
-	it = Node::findMatch(locs, loc);
-	if ( it == locs.end() ) return false;
+	bool requested = _streams.find(id) != _streams.end();
+	for ( size_t i = 0; !requested && i < _patterns.size(); ++i )
+		requested = _patterns[i].matches(net, sta, loc, cha);
 
-	const Node::List &chas = it->childs;
-	it = Node::findMatch(chas, cha);
-	if ( it == chas.end() ) return false;
-
-	return true;
+	_decisions[id] = requested;
+	return requested;
 }
 // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
 
@@ -274,6 +492,11 @@ bool VSConnection::isRequested(const string &net, const string &sta,
 void VSConnection::close() {
 	_closeRequested = true;
 	if ( _connection ) _connection->disconnect();
+
+	// Wake up next() and the receiver
+	std::lock_guard<std::mutex> lock(_messageMutex);
+	_messageAvailable.notify_all();
+	_spaceAvailable.notify_all();
 }
 // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
 
@@ -282,7 +505,7 @@ void VSConnection::close() {
 
 // >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 Record *VSConnection::next() {
-	if ( _queue != NULL ) return NULL;
+	if ( _queue != NULL ) return dequeue();
 
 	if ( !_connection ) {
 		if ( !connect() ) {
@@ -290,56 +513,175 @@ Record *VSConnection::next() {
 			return NULL;
 		}
 		_closeRequested = false;
+
+		{
+			std::lock_guard<std::mutex> lock(_messageMutex);
+			_messages.clear();
+			_receiving = true;
+		}
+
+		_receiver = std::thread(&VSConnection::receive, this);
 	}
 
 	while ( !_closeRequested ) {
-		Message *msg = _connection->recv();
+		ReceivedMessage received;
+		size_t depth, dropped;
+
+		{
+			std::unique_lock<std::mutex> lock(_messageMutex);
+			_messageAvailable.wait(lock, [this] {
+				return _closeRequested || !_messages.empty() || !_receiving;
+			});
 
-		if ( msg ) {
-			for ( MessageIterator it = msg->iter(); *it; ++it ) {
-				DataModel::VS::Envelope *e = DataModel::VS::Envelope::Cast(*it);
-				if ( e != NULL ) {
-					if ( handle(e) ) {
-						VSRecord *rec = _queue;
-						_queue = _queue->next;
-						rec->next = NULL;
+			if ( _closeRequested || _messages.empty() ) break;
 
-						setupRecord(rec);
+			received = _messages.front();
+			_messages.pop_front();
+			depth = _messages.size();
+			dropped = _droppedMessages;
+		}
 
-						if ( rec->data()->dataType() != rec->dataType() )
-							rec->setData(rec->data()->copy(rec->dataType()));
+		_spaceAvailable.notify_one();
 
-						return rec;
-					}
-				}
-			}
+		reportBacklog(depth, dropped, (double)(Core::Time::GMT() - received.received));
+
+		// Handle all envelopes of the message, the records are
+		// returned from the queue with the next calls
+		for ( MessageIterator it = received.msg->iter(); *it; ++it ) {
+			DataModel::VS::Envelope *e = DataModel::VS::Envelope::Cast(*it);
+			if ( e != NULL ) handle(e);
 		}
-		else if ( !_closeRequested ) {
+
+		flushPending();
+
+		if ( _queue != NULL ) return dequeue();
+	}
+
+	return NULL;
+}
+// <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+
+
+
+
+// >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+void VSConnection::receive() {
+	while ( !_closeRequested ) {
+		MessagePtr msg = _connection->recv();
+
+		if ( !msg ) {
+			if ( _closeRequested ) break;
 			if ( _connection->isConnected() ) continue;
+			if ( !reconnect() ) break;
+			continue;
+		}
 
-			SEISCOMP_WARNING("Connection lost, trying to reconnect");
-			bool first = true;
-			while ( !_closeRequested ) {
-				_connection->reconnect();
-				if ( _connection->isConnected() ) {
-					SEISCOMP_INFO("Reconnected successfully");
-					continue;
+		ReceivedMessage received;
+		received.msg = msg;
+		received.received = Core::Time::GMT();
+
+		{
+			std::unique_lock<std::mutex> lock(_messageMutex);
+
+			if ( _messages.size() >= _maxMessages ) {
+				if ( _dropOldest ) {
+					// Keep the latest messages if the consumer falls behind
+					_messages.pop_front();
+					++_droppedMessages;
+					if ( _droppedMessages == 1 || _droppedMessages % 1000 == 0 )
+						SEISCOMP_WARNING("Receive queue is full (%d messages), dropped %d messages so far",
+						                 (int)_maxMessages, (int)_droppedMessages);
 				}
 				else {
-					if ( first ) {
-						first = false;
-						SEISCOMP_INFO("Reconnecting failed, trying again every 2 seconds");
-					}
-					sleep(2);
+					// Stop receiving until the consumer caught up so that
+					// the backpressure reaches the messaging connection
+					_spaceAvailable.wait(lock, [this] {
+						return _closeRequested || _messages.size() < _maxMessages;
+					});
+					if ( _closeRequested ) break;
 				}
 			}
 
-			if ( _closeRequested )
-				break;
+			_messages.push_back(received);
 		}
-		else
-			break;
+
+		_messageAvailable.notify_one();
 	}
 
-	return NULL;
+	std::lock_guard<std::mutex> lock(_messageMutex);
+	_receiving = false;
+	_messageAvailable.notify_all();
 }
+// <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+
+
+
+
+// >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+bool VSConnection::reconnect() {
+	SEISCOMP_WARNING("Connection lost, trying to reconnect");
+
+	bool first = true;
+	while ( !_closeRequested ) {
+		_connection->reconnect();
+		if ( _connection->isConnected() ) {
+			SEISCOMP_INFO("Reconnected successfully");
+			return true;
+		}
+
+		if ( first ) {
+			first = false;
+			SEISCOMP_INFO("Reconnecting failed, trying again every 2 seconds");
+		}
+
+		// Sleep in short steps to react on close requests
+		for ( int i = 0; i < 20 && !_closeRequested; ++i )
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	return false;
+}
+// <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+
+
+
+
+// >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+void VSConnection::stopReceiver() {
+	if ( !_receiver.joinable() ) return;
+
+	close();
+	_receiver.join();
+
+	std::lock_guard<std::mutex> lock(_messageMutex);
+	_messages.clear();
+}
+// <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+
+
+
+
+// >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+void VSConnection::reportBacklog(size_t depth, size_t dropped, double age) {
+	bool late = age > MaxMessageAge || dropped > _reportedDrops;
+
+	Core::Time now = Core::Time::GMT();
+	if ( _lastReport.valid()
+	  && (double)(now - _lastReport) < (late ? LateReportInterval : ReportInterval) )
+		return;
+
+	_lastReport = now;
+
+	// Warn if the consumer falls behind
+	if ( late )
+		SEISCOMP_WARNING("Receive queue: %d messages waiting, %d messages dropped "
+		                 "in total, latest message waited %.3fs",
+		                 (int)depth, (int)dropped, age);
+	else
+		SEISCOMP_INFO("Receive queue: %d messages waiting, %d messages dropped "
+		              "in total, latest message waited %.3fs",
+		              (int)depth, (int)dropped, age);
+
+	_reportedDrops = dropped;
+}
+// <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
@@ -28,43 +28,58 @@
 #include <seiscomp/datamodel/vs/vs_package.h>
 #include <seiscomp/messaging/connection.h>
 
-#include <set>
-
-
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+/**
+ * @brief The VSRecord class is a generic record which is allocated from a
+ *        pool. Memory of deleted records is kept and reused for the next
+ *        records so that the allocations per envelope value are reduced.
+ */
 class VSRecord : public Seiscomp::GenericRecord {
 	public:
 		VSRecord() : next(NULL) {}
 
 		void read(std::istream &in) {}
 
+		static void *operator new(size_t size);
+		static void operator delete(void *ptr, size_t size);
+
 	public:
 		VSRecord *next;
 };
 
 
-struct Node {
-	Node(const std::string &c) : code(c) {}
+//! A subscription which contains wildcards in at least one of its codes
+struct StreamPattern {
+	StreamPattern(const std::string &n, const std::string &s,
+	              const std::string &l, const std::string &c)
+	: net(n), sta(s), loc(l), cha(c) {}
 
-	std::string code;
-
-	bool operator<(const Node &node ) const {
-		return code < node.code;
+	bool operator==(const StreamPattern &other) const {
+		return net == other.net && sta == other.sta
+		    && loc == other.loc && cha == other.cha;
 	}
 
-	bool matches(const std::string &c) const {
-		return Seiscomp::Core::wildcmp(code, c);
+	bool matches(const std::string &n, const std::string &s,
+	             const std::string &l, const std::string &c) const {
+		return Seiscomp::Core::wildcmp(net, n)
+		    && Seiscomp::Core::wildcmp(sta, s)
+		    && Seiscomp::Core::wildcmp(loc, l)
+		    && Seiscomp::Core::wildcmp(cha, c);
 	}
 
-	typedef std::set<Node> List;
-	static List::const_iterator findMatch(const List &list, const std::string &code) {
-		List::const_iterator it;
-		for ( it = list.begin(); it != list.end(); ++it ) {
-			if ( it->matches(code) ) return it;
-		}
-		return it;
-	}
-
-	mutable List childs;
+	std::string net;
+	std::string sta;
+	std::string loc;
+	std::string cha;
 };
 
 
@@ -117,24 +132,98 @@ class VSConnection : public Seiscomp::IO::RecordStream {
 		//! Removes all stream list, time window, etc. -entries from the connection description object.
 		bool clear();
 
-		//! Reconnects a terminated arclink connection.
+		//! Reconnects a terminated connection, retries until it succeeds
+		//! or close() is called
 		bool reconnect();
 
+		//! Receives messages into the receive queue, runs in its own thread
+		void receive();
+
+		//! Stops and joins the receiver thread
+		void stopReceiver();
+
+		//! Logs the receive queue depth, the dropped messages and the age
+		//! of the latest message in regular intervals
+		void reportBacklog(size_t depth, size_t dropped, double age);
+
+
+	private:
+		//! Consecutive values of a stream which are not yet queued
+		struct PendingRecord {
+			std::string             net;
+			std::string             sta;
+			std::string             loc;
+			std::string             cha;
+			Seiscomp::Core::Time    startTime;
+			std::vector<float>      samples;
+		};
+
+		typedef std::unordered_map<std::string, PendingRecord> PendingRecords;
+
+		struct ReceivedMessage {
+			Seiscomp::Core::MessagePtr msg;
+			Seiscomp::Core::Time       received;
+		};
+
+		typedef std::deque<ReceivedMessage> MessageQueue;
+
 
 	private:
 		bool connect();
 		bool handle(Seiscomp::DataModel::VS::Envelope *);
-		bool isRequested(const std::string &net, const std::string &sta,
+		bool isRequested(const std::string &id,
+		                 const std::string &net, const std::string &sta,
 		                 const std::string &loc, const std::string &cha) const;
 
+		//! Creates a record of the pending values and appends it to the queue
+		void queue(PendingRecord &pending);
+		//! Queues pending records which cannot be continued anymore
+		//! because a later envelope timestamp has been received
+		void flushPending();
+		Seiscomp::Record *dequeue();
+		void clearQueue();
+
 
 	private:
+		// Subscribed stream ids (net.sta.loc.cha) without wildcards
+		typedef std::unordered_set<std::string> StreamIDs;
+		typedef std::vector<StreamPattern> StreamPatterns;
+		// Whether a stream id is requested, filled on the first envelope
+		// value of a stream
+		typedef std::unordered_map<std::string, bool> Decisions;
+
 		std::string                      _host;
 		std::string                      _group;
-		bool                             _closeRequested;
+		std::atomic<bool>                _closeRequested;
 		Seiscomp::Client::ConnectionPtr  _connection;
-		Node::List                       _streams;
+		StreamIDs                        _streams;
+		StreamPatterns                   _patterns;
+		mutable Decisions                _decisions;
+		// Maximum number of samples per record
+		size_t                           _maxSamples;
+		PendingRecords                   _pending;
+		// Latest envelope timestamp and the timestamp of the last flush
+		Seiscomp::Core::Time             _latestTimestamp;
+		Seiscomp::Core::Time             _flushedTimestamp;
 		VSRecord                        *_queue;
+		VSRecord                        *_queueTail;
+
+		// Messages are received by a separate thread so that next() is
+		// not blocked by the messaging I/O and reconnects
+		std::thread                      _receiver;
+		mutable std::mutex               _messageMutex;
+		std::condition_variable          _messageAvailable;
+		std::condition_variable          _spaceAvailable;
+		MessageQueue                     _messages;
+		bool                             _receiving;
+		// Maximum number of queued messages. If the queue is full the
+		// receiver waits for the consumer or, if configured, drops the
+		// oldest message.
+		size_t                           _maxMessages;
+		bool                             _dropOldest;
+		size_t                           _droppedMessages;
+		size_t                           _reportedDrops;
+		Seiscomp::Core::Time             _lastReport;
 };
 
 
@@ -0,0 +1,118 @@
+/***************************************************************************
+ *   Copyright (C) by ETHZ/SED                                             *
+ *                                                                         *
+ * This program is free software: you can redistribute it and/or modify    *
+ * it under the terms of the GNU Affero General Public License as published*
+ * by the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                     *
+ *                                                                         *
+ * This program is distributed in the hope that it will be useful,         *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           *
+ * GNU Affero General Public License for more details.                     *
+ ***************************************************************************/
+
+// Compares VsEquations::gridsearch with the plain grid search over
+// VsEquations::likelihood for random station sets. Both must return
+// exactly the same magnitude and likelihood.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "equations.h"
+
+
+namespace {
+
+struct Station {
+	float ZA, ZV, ZD, HA, HV, HD;
+	int PSclass, Soilclass;
+	float lat, lon;
+};
+
+
+float uniform(float min, float max) {
+	return min + (max - min) * (float)rand() / (float)RAND_MAX;
+}
+
+
+float reference(VsEquations &vs, const std::vector<Station> &stations,
+                float &minL) {
+	float mag = 0.5f;
+	float minMag = mag;
+	minL = -1.0f;
+
+	while ( mag <= 9.0f ) {
+		float L = 0.0f;
+
+		for ( size_t i = 0; i < stations.size(); ++i ) {
+			const Station &s = stations[i];
+			vs.setmag(mag);
+			L += vs.likelihood(s.ZA, s.ZV, s.ZD, s.HA, s.HV, s.HD,
+			                   s.PSclass, s.Soilclass, s.lat, s.lon);
+		}
+
+		if ( minL < 0 || minL > L ) {
+			minL = L;
+			minMag = mag;
+		}
+
+		mag += 0.01f;
+	}
+
+	return minMag;
+}
+
+}
+
+
+int main() {
+	int failures = 0;
+	srand(42);
+
+	for ( int run = 0; run < 200; ++run ) {
+		VsEquations vs;
+		vs.seteqlat(uniform(-60, 60));
+		vs.seteqlon(uniform(-180, 180));
+
+		std::vector<Station> stations(1 + rand() % 20);
+		std::vector<VsEquations::StationTerms> terms;
+
+		for ( size_t i = 0; i < stations.size(); ++i ) {
+			Station &s = stations[i];
+			// Envelope values in cm/s**2, cm/s and cm over several decades
+			s.ZA = pow(10.0f, uniform(-3, 2));
+			s.ZV = pow(10.0f, uniform(-4, 1));
+			s.ZD = pow(10.0f, uniform(-5, 0));
+			s.HA = pow(10.0f, uniform(-3, 2));
+			s.HV = pow(10.0f, uniform(-4, 1));
+			s.HD = pow(10.0f, uniform(-5, 0));
+			s.PSclass = vs.psclass(s.ZA, s.ZV, s.HA, s.HV);
+			s.Soilclass = rand() % 2;
+			s.lat = vs.geteqlat() + uniform(-2, 2);
+			s.lon = vs.geteqlon() + uniform(-2, 2);
+			terms.push_back(vs.stationterms(s.ZA, s.ZV, s.ZD, s.HA, s.HV, s.HD,
+			                                s.PSclass, s.Soilclass, s.lat, s.lon));
+		}
+
+		float refL, minL;
+		float refMag = reference(vs, stations, refL);
+		float minMag = vs.gridsearch(terms, minL);
+
+		if ( refMag != minMag || refL != minL ) {
+			fprintf(stderr, "run %d: expected M=%.2f L=%.9g, got M=%.2f L=%.9g\n",
+			        run, refMag, refL, minMag, minL);
+			++failures;
+		}
+	}
+
+	if ( failures ) {
+		fprintf(stderr, "%d of 200 grid searches differ\n", failures);
+		return 1;
+	}
+
+	printf("all grid searches match\n");
+	return 0;
+}